@@ -2,46 +2,112 @@
 // Implements low-level file system functionality that interfaces with
 // the disk.
 
+#include <cstring>
+#include <cstdlib>
+#include <iostream>
+#include <atomic>
+using namespace std;
+
 #include "Disk.h"
 #include "Blocks.h"
 #include "BasicFileSys.h"
+#include "Trace.h"
+
+// Allocation group a thread allocates in when it has no block to follow:
+// threads are spread over the groups in the order they first allocate.
+// This is for locality only (a session's inodes and directories stay near
+// each other); every allocation still holds the one Volume::lock, and the
+// free space index is shared by all groups.
+static atomic<int> next_home_group(0);
+static thread_local int home_group = -1;
+
+// Block holding the bitmap of group: the group's first block, or for
+// group 0 the first after the superblock and the root directory
+static short bitmap_block(int group)
+{
+  return group == 0 ? 2 : group * GROUP_BLOCKS;
+}
 
-// Mounts the simulated disk file. If a disk file is created, this
-// routines also "formats" the disk by initializing special blocks
-// 0 (superblock) and 1 (root directory).
-void BasicFileSys::mount()
+// Mounts the simulated disk file, or files if it is striped. If the disk
+// is created, this routines also "formats" the disk by initializing special
+// blocks 0 (superblock), 1 (root directory) and the bitmap of every
+// allocation group.
+void BasicFileSys::mount(const char *disk_name)
 {
   // mount the disk
-  bool new_disk = disk.mount("DISK");
+  bool new_disk = disk.mount(disk_name);
 
-  // if the disk exists, return as no further initialization is needed
-  if (!new_disk) return;
+  // if the disk exists, make sure it uses this block layout; no further
+  // initialization is needed
+  if (!new_disk) {
+    struct superblock_t super_block;
+    disk.read_block(0, (void *) &super_block);
+    if (super_block.magic != SUPER_MAGIC_NUM || super_block.num_groups != NUM_GROUPS) {
+      cerr << "Disk has an unknown format; remove it to create a new one" << endl;
+      exit(-1);
+    }
+    // block 0 is at the start of the first file whatever the layout, but
+    // any other block read through the wrong one would be garbage
+    int files = super_block.stripe_files;
+    if (files != disk.stripe_files() ||
+        (files > 1 && super_block.stripe_blocks != disk.stripe_blocks())) {
+      cerr << "Disk was formatted striped over " << files << " file(s)";
+      if (files > 1) {
+        cerr << ", " << (int) super_block.stripe_blocks << " blocks per unit";
+      }
+      cerr << "; mount it with that layout" << endl;
+      exit(-1);
+    }
+    build_free_index();
+    return;
+  }
+
+  // zero out every block, a group at a time
+  vector<datablock_t> zeros(GROUP_BLOCKS);
+  memset(zeros.data(), 0, GROUP_BLOCKS * sizeof(datablock_t));
+  vector<short> block_nums(GROUP_BLOCKS);
+  for (int group = 0; group < NUM_GROUPS; group++) {
+    for (int i = 0; i < GROUP_BLOCKS; i++) {
+      block_nums[i] = group * GROUP_BLOCKS + i;
+    }
+    disk.write_blocks(block_nums.data(), GROUP_BLOCKS, zeros.data());
+  }
 
   // initialize the superblock
   struct superblock_t super_block;
-  super_block.bitmap[0] = 0x3;		// mark blocks 0 and 1 as used
-  for (int i = 1; i < BLOCK_SIZE; i++) {
-    super_block.bitmap[i] = 0;
-  }
+  memset(&super_block, 0, sizeof(super_block));
+  super_block.magic = SUPER_MAGIC_NUM;
+  super_block.num_groups = NUM_GROUPS;
+  super_block.stripe_files = disk.stripe_files();
+  super_block.stripe_blocks = disk.stripe_blocks();
   disk.write_block(0, (void *) &super_block);
 
   // initialize the root directory
   struct dirblock_t dir_block;
   dir_block.magic = DIR_MAGIC_NUM;
   dir_block.num_entries = 0;
+  dir_block.tree_bytes = 0;
+  dir_block.tree_blocks = 1;
+  dir_block.parent = 1;		// the root is its own parent
+  dir_block.reserved = 0;
   for (int i = 0; i < MAX_DIR_ENTRIES; i++) {
     dir_block.dir_entries[i].block_num = 0;
   }
   disk.write_block(1, (void *) &dir_block);
 
-  // write a zeroed-out data block to all other blocks on disk
-  struct datablock_t data_block;
-  for (int i = 0; i < BLOCK_SIZE; i++) {
-    data_block.data[i] = 0;
-  }
-  for (int i = 2; i < NUM_BLOCKS; i++) {
-    disk.write_block(i, (void *) &data_block);
+  // initialize the bitmaps: each group's bitmap block is used, and group
+  // 0's superblock and root directory
+  for (int group = 0; group < NUM_GROUPS; group++) {
+    struct bitmapblock_t bitmap_block_data;
+    memset(&bitmap_block_data, 0, sizeof(bitmap_block_data));
+    int used = bitmap_block(group) - group * GROUP_BLOCKS + 1;
+    for (int i = 0; i < used; i++) {
+      bitmap_block_data.bitmap[i / 8] |= 1 << (i % 8);
+    }
+    bitmap_block_data.free_blocks = GROUP_BLOCKS - used;
+    disk.write_block(bitmap_block(group), (void *) &bitmap_block_data);
   }
+  build_free_index();
 }
 
 // Unmounts the disk
@@ -50,61 +116,241 @@ void BasicFileSys::unmount()
   disk.unmount();
 }
 
-// Gets a free block from the disk.
-short BasicFileSys::get_free_block()
+// Gets a free block from the disk: the first free one after near, or if
+// near is 0 the first free one in the calling thread's group.
+short BasicFileSys::get_free_block(short near)
 {
-  // get superblock
-  struct superblock_t super_block;
-  disk.read_block(0, (void *) &super_block);
-  
-  // look for first available block
-  for (int byte = 0; byte < BLOCK_SIZE; byte++) {
-
-    // check to see if byte has available slot
-    if (super_block.bitmap[byte] != 0xFF) {
- 
-      // loop to check each bit
-      for (int bit = 0; bit < 8; bit++) {
-        int mask = 1 << bit;
-	if (mask & ~super_block.bitmap[byte]) {
-
-          // Available block is found: set bit in bitmap, write result back
-	  // to superblock, and return block number.
-	  super_block.bitmap[byte] |= mask;
-	  disk.write_block(0, (void *) &super_block);
-	  return (byte * 8) + bit;
-	}
-      }
+  return get_free_blocks(1, near);
+}
+
+// Gets count contiguous free blocks from the free space index, starting
+// after near or in the calling thread's group, else in the nearest free
+// extent long enough, else in the shortest long enough anywhere. No
+// extent spans two groups, as each group's first block is in use, so the
+// blocks are marked used in one bitmap.
+short BasicFileSys::get_free_blocks(int count, short near)
+{
+  TraceScope span("allocate block", -1, count);
+
+  int target;
+  if (near > 0) {
+    target = near + 1;
+  } else {
+    if (home_group == -1) {
+      home_group = next_home_group++ % NUM_GROUPS;
     }
+    target = home_group * GROUP_BLOCKS;
+  }
+  int first = free_index.find(count, target);
+  if (first == -1) {
+    // disk is full, or too fragmented
+    return 0;
   }
+  free_index.take(first, count);
 
-  // disk is full
-  return 0;
+  // set the bits in the group's bitmap and write it back
+  int group = first / GROUP_BLOCKS;
+  struct bitmapblock_t bitmap;
+  read_block(bitmap_block(group), (void *) &bitmap);
+  for (int bit = first % GROUP_BLOCKS; bit < first % GROUP_BLOCKS + count; bit++) {
+    bitmap.bitmap[bit / 8] |= 1 << (bit % 8);
+  }
+  bitmap.free_blocks -= count;
+  write_block(bitmap_block(group), (void *) &bitmap);
+  span.set_block(first);
+  return first;
 }
   
 // Reclaims block making it available for future use.
 void BasicFileSys::reclaim_block(short block_num)
 {
-  // get superblock
-  struct superblock_t super_block;
-  disk.read_block(0, (void *) &super_block);
+  TraceScope span("reclaim block", block_num, 1);
+
+  // get the bitmap of the block's group
+  int group = block_num / GROUP_BLOCKS;
+  struct bitmapblock_t bitmap;
+  read_block(bitmap_block(group), (void *) &bitmap);
 
   // clear bit
-  int byte = block_num / 8;		// byte number
-  int bit = block_num % 8;		// bit number
-  unsigned char mask = ~(1 << bit);	// mask to clear bit
-  super_block.bitmap[byte] &= mask;
+  int bit = block_num % GROUP_BLOCKS;
+  unsigned char mask = ~(1 << (bit % 8));	// mask to clear bit
+  if (bitmap.bitmap[bit / 8] & ~mask) {
+    bitmap.free_blocks++;
+    free_index.insert(block_num, 1);
+  }
+  bitmap.bitmap[bit / 8] &= mask;
 
-  // write back superblock
-  disk.write_block(0, (void *) &super_block);
+  // write back the bitmap
+  write_block(bitmap_block(group), (void *) &bitmap);
 }
   
+// Reclaims all of the blocks with one read and write of each group's
+// bitmap.
+void BasicFileSys::reclaim_blocks(const vector<short> &block_nums)
+{
+  if (block_nums.empty()) return;
+  TraceScope span("reclaim blocks", block_nums[0], block_nums.size());
+
+  // get the bitmaps of the groups involved
+  map<int, bitmapblock_t> bitmaps;
+  for (size_t i = 0; i < block_nums.size(); i++) {
+    int group = block_nums[i] / GROUP_BLOCKS;
+    if (bitmaps.find(group) == bitmaps.end()) {
+      read_block(bitmap_block(group), (void *) &bitmaps[group]);
+    }
+  }
+
+  // clear each bit
+  for (size_t i = 0; i < block_nums.size(); i++) {
+    struct bitmapblock_t &bitmap = bitmaps[block_nums[i] / GROUP_BLOCKS];
+    int bit = block_nums[i] % GROUP_BLOCKS;
+    if (bitmap.bitmap[bit / 8] & (1 << (bit % 8))) {
+      bitmap.free_blocks++;
+      free_index.insert(block_nums[i], 1);
+    }
+    bitmap.bitmap[bit / 8] &= (unsigned char) ~(1 << (bit % 8));
+  }
+
+  // write back the bitmaps
+  for (map<int, bitmapblock_t>::iterator it = bitmaps.begin(); it != bitmaps.end(); it++) {
+    write_block(bitmap_block(it->first), (void *) &it->second);
+  }
+}
+
+// Returns the number of free blocks, from the free space index.
+int BasicFileSys::free_block_count()
+{
+  return free_index.free_blocks();
+}
+
+// Rebuilds the free space index from every group's bitmap, as a run of
+// clear bits at a time.
+void BasicFileSys::build_free_index()
+{
+  free_index.clear();
+  for (int group = 0; group < NUM_GROUPS; group++) {
+    struct bitmapblock_t bitmap;
+    read_block(bitmap_block(group), (void *) &bitmap);
+    int run = -1; // first bit of the current run of free blocks
+    for (int bit = 0; bit <= GROUP_BLOCKS; bit++) {
+      bool free = bit < GROUP_BLOCKS && !(bitmap.bitmap[bit / 8] & (1 << (bit % 8)));
+      if (free && run == -1) {
+        run = bit;
+      } else if (!free && run != -1) {
+        free_index.insert(group * GROUP_BLOCKS + run, bit - run);
+        run = -1;
+      }
+    }
+  }
+}
+
+// Returns the disk requests made since the disk was mounted.
+const DiskStats &BasicFileSys::disk_stats()
+{
+  return disk.stats();
+}
+
+// Makes disk I/O cost what it would on the emulated device.
+void BasicFileSys::set_disk_model(const DiskModel &model)
+{
+  disk.set_model(model);
+}
+
+// Returns the number of mirrors of the disk.
+int BasicFileSys::mirror_count()
+{
+  return disk.mirror_count();
+}
+
+// Describes the state of every mirror of the disk.
+string BasicFileSys::mirror_status()
+{
+  return disk.mirror_status();
+}
+
 // Reads block from disk. Output parameter block points to new block.
+// Inside a transaction, blocks written by the transaction are read from
+// memory.
 void BasicFileSys::read_block(short block_num, void *block) {
+  if (in_transaction) {
+    map<short, datablock_t>::iterator it = transaction_blocks.find(block_num);
+    if (it != transaction_blocks.end()) {
+      memcpy(block, &it->second, BLOCK_SIZE);
+      return;
+    }
+  }
   disk.read_block(block_num, block);
 }
 
 // Writes block to disk. Input block points to block to write.
+// Inside a transaction, the write is held until commit.
 void BasicFileSys::write_block(short block_num, void *block) {
+  if (in_transaction) {
+    memcpy(&transaction_blocks[block_num], block, BLOCK_SIZE);
+    return;
+  }
   disk.write_block(block_num, block);
 }
+
+// Reads count blocks at once. Output block i is at blocks[i].
+void BasicFileSys::read_blocks(const short *block_nums, int count, datablock_t *blocks) {
+  if (in_transaction) {
+    // blocks written by the transaction have to come from memory
+    for (int i = 0; i < count; i++) {
+      read_block(block_nums[i], (void *) &blocks[i]);
+    }
+    return;
+  }
+  disk.read_blocks(block_nums, count, (void *) blocks);
+}
+
+// Writes count blocks at once. Inside a transaction, the writes are held
+// until commit like those of write_block.
+void BasicFileSys::write_blocks(const short *block_nums, int count, datablock_t *blocks) {
+  if (in_transaction) {
+    for (int i = 0; i < count; i++) {
+      write_block(block_nums[i], (void *) &blocks[i]);
+    }
+    return;
+  }
+  disk.write_blocks(block_nums, count, (void *) blocks);
+}
+
+// Finds where block_num is stored on the disk so its contents can be
+// sent without reading them into memory. Returns how many blocks from
+// block_num on follow it in the same file, or 0 if the disk's copy may be
+// out of date (inside a transaction).
+int BasicFileSys::map_block(short block_num, int &block_fd, off_t &offset) {
+  if (in_transaction) {
+    return 0;
+  }
+  return disk.map_block(block_num, block_fd, offset);
+}
+
+// Starts a transaction. Blocks written until the transaction ends are
+// held in memory and reach the disk only on commit.
+void BasicFileSys::begin_transaction() {
+  transaction_blocks.clear();
+  in_transaction = true;
+}
+
+// Writes every block changed in the transaction to disk, in block order.
+void BasicFileSys::commit_transaction() {
+  TraceScope span("commit transaction", -1, transaction_blocks.size());
+  in_transaction = false;
+  map<short, datablock_t>::iterator it;
+  for (it = transaction_blocks.begin(); it != transaction_blocks.end(); it++) {
+    disk.write_block(it->first, (void *) &it->second);
+  }
+  transaction_blocks.clear();
+}
+
+// Discards every block changed in the transaction.
+void BasicFileSys::abort_transaction() {
+  in_transaction = false;
+  transaction_blocks.clear();
+
+  // the bitmaps on disk no longer have the transaction's allocations and
+  // reclaims
+  build_free_index();
+}
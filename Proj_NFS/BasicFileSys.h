@@ -5,33 +5,101 @@
 #ifndef BASIC_FILESYS_H
 #define BASIC_FILESYS_H
 
+#include <map>
+#include <vector>
 #include "Disk.h"
+#include "Blocks.h"
+#include "FreeExtents.h"
 
 // Basic File 
 class BasicFileSys {
 
   public:
-    // Mounts the disk.  If the disk is new, it formats the disk by
-    // initializing special blocks 0 (superblock) and 1 (root directory). 
-    void mount();
+    // Mounts the disk file disk_name, or the files it is striped over if
+    // disk_name is a layout such as "d0,d1,d2:4" (see Disk::parse_layout).
+    // If the disk is new, it formats the disk by initializing special
+    // blocks 0 (superblock), 1 (root directory) and the bitmap of every
+    // allocation group. A disk mounted with another layout than it was
+    // formatted with aborts the program.
+    void mount(const char *disk_name = "DISK");
 
     // Unmounts the disk.
     void unmount();
 
-    // Gets a free block from the disk.
-    short get_free_block();
+    // Gets a free block from the disk, 0 if it is full. The block is the
+    // one after near if it is free, else the closest free one, so a
+    // file's blocks follow its inode and each other; with no near (0) it
+    // is in the calling thread's own group, so each session's new files
+    // cluster in one region of the disk. Allocation still runs under the
+    // volume's lock: the groups spread the files, not the locking.
+    short get_free_block(short near = 0);
+
+    // Gets count contiguous free blocks, placed like get_free_block's,
+    // and returns the first; 0 if no free extent is that long. Takes
+    // logarithmic time in the number of free extents.
+    short get_free_blocks(int count, short near = 0);
   
     // Reclaims block making it available for future use.
     void reclaim_block(short block_num);
 
+    // Reclaims all of the blocks with one update of each group's bitmap.
+    void reclaim_blocks(const std::vector<short> &block_nums);
+
+    // Returns the number of free blocks, kept in the free space index.
+    int free_block_count();
+
+    // Returns the free space index, for reports.
+    const FreeExtents &free_extents() const { return free_index; }
+
+    // Returns the disk requests made since the disk was mounted.
+    const DiskStats &disk_stats();
+
+    // Makes disk I/O cost what it would on the emulated device.
+    void set_disk_model(const DiskModel &model);
+
+    // Returns the number of mirrors of the disk (1 if not mirrored).
+    int mirror_count();
+
+    // Describes the state of every mirror of the disk.
+    std::string mirror_status();
+
     // Reads block from disk. Output parameter block points to new block.
     void read_block(short block_num, void *block);
   
     // Writes block to disk. Input block points to block to write.
     void write_block(short block_num, void *block);
 
+    // Reads count blocks at once. Output block i is at blocks[i].
+    void read_blocks(const short *block_nums, int count, datablock_t *blocks);
+
+    // Writes count blocks at once. Input block i is at blocks[i].
+    void write_blocks(const short *block_nums, int count, datablock_t *blocks);
+
+    // Finds where block_num is stored on the disk so its contents can be
+    // sent without reading them into memory. Returns how many blocks from
+    // block_num on follow it in the same file, or 0 if the disk's copy may
+    // be out of date (inside a transaction).
+    int map_block(short block_num, int &block_fd, off_t &offset);
+
+    // Starts a transaction. Blocks written until the transaction ends are
+    // held in memory (reads see them) and reach the disk only on commit.
+    void begin_transaction();
+
+    // Writes every block changed in the transaction to disk.
+    void commit_transaction();
+
+    // Discards every block changed in the transaction, and rebuilds the
+    // free space index from the bitmaps on disk.
+    void abort_transaction();
+
   private:
     Disk disk;
+    FreeExtents free_index; // free blocks, rebuilt from the bitmaps at mount
+    bool in_transaction = false;
+    std::map<short, datablock_t> transaction_blocks; // uncommitted writes
+
+    // Rebuilds free_index from the groups' bitmaps.
+    void build_free_index();
 };
 
 #endif
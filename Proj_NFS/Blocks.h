@@ -8,14 +8,21 @@
 // Size of block - must be an even power of two 
 const int BLOCK_SIZE = 128;
 
-// Number of blocks - set so a bitmap can fit in one block
-const int NUM_BLOCKS = (BLOCK_SIZE * 8);
+// Blocks in an allocation group - set so the group's bitmap fits in one
+// block after its 8-byte header
+const int GROUP_BLOCKS = ((BLOCK_SIZE - 8) * 8);
+
+// Number of allocation groups
+const int NUM_GROUPS = 8;
+
+// Number of blocks
+const int NUM_BLOCKS = (NUM_GROUPS * GROUP_BLOCKS);
 
 // Maximum filename size
 const int MAX_FNAME_SIZE = 9;
 
 // Maximum number of files in a directory
-const int MAX_DIR_ENTRIES = ((BLOCK_SIZE - 8) / 12);
+const int MAX_DIR_ENTRIES = ((BLOCK_SIZE - 20) / 12);
 
 // Maximum number of blocks in a data file
 const int MAX_DATA_BLOCKS = ((BLOCK_SIZE - 8) / 2);
@@ -27,18 +34,42 @@ const int MAX_FILE_SIZE	= (MAX_DATA_BLOCKS * BLOCK_SIZE);
 const unsigned int DIR_MAGIC_NUM = 0xFFFFFFFF;
 const unsigned int INODE_MAGIC_NUM = 0xFFFFFFFE;
 
+// Magic number that identifies a disk formatted with this block layout
+const unsigned int SUPER_MAGIC_NUM = 0x4E465332;
+
 // BLOCK TYPES
 
-// Superblock - keeps track of which blocks are used in the filesystem.
-// Block 0 is the only super block in the system.
+// Superblock - describes the disk. Block 0 is the only super block in the
+// system. The layout the disk was formatted with is recorded so it cannot
+// be mounted with another.
 struct superblock_t {
-  unsigned char bitmap[BLOCK_SIZE]; // bitmap of free blocks
+  unsigned int magic;		// magic number, must be SUPER_MAGIC_NUM
+  unsigned short num_groups;	// allocation groups, NUM_GROUPS
+  unsigned char stripe_files;	// files the blocks are striped over
+  unsigned char stripe_blocks;	// blocks per stripe unit
+  char reserved[BLOCK_SIZE - 8];
+};
+
+// Bitmap block - keeps track of which blocks of an allocation group are
+// used. Group g covers blocks g * GROUP_BLOCKS on, and its bitmap is the
+// group's first block (block 2 for group 0, after the superblock and the
+// root directory).
+struct bitmapblock_t {
+  unsigned int free_blocks;	// number of free blocks in the group
+  unsigned int reserved;
+  unsigned char bitmap[BLOCK_SIZE - 8]; // bit i set: block i of the group is used
 };
 
 // Directory block - represents a directory
+// The totals cover the directory and everything below it and are kept up
+// to date as files and directories change, so they never require a walk.
 struct dirblock_t {
   unsigned int magic;		// magic number, must be DIR_MAGIC_NUM
   unsigned int num_entries;	// number of files in directory
+  unsigned int tree_bytes;	// bytes in all data files below directory
+  unsigned int tree_blocks;	// blocks used by directory and all below it
+  short parent;			// parent directory block (root: itself)
+  short reserved;		// unused, keeps entries aligned
   struct {
     char name[MAX_FNAME_SIZE + 1]; // file name (extra space for null)
     short block_num;		   // block number of file (0 - unused)
@@ -0,0 +1,530 @@
+// CPSC 3500: Channel
+// Byte streams between the shell and the server.
+
+#include <iostream>
+#include <algorithm>    // For std::min
+#include <atomic>
+#include <climits>      // For INT_MAX
+#include <cstring>      // For memcpy, memset, strerror
+#include <cstdint>
+#include <errno.h>
+#include <fcntl.h>      // For O_* constants
+#include <signal.h>     // For kill
+#include <unistd.h>     // For close, pread, unlink
+#include <sys/mman.h>   // For shm_open, mmap
+#include <sys/stat.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/sendfile.h>
+#include <sys/syscall.h>
+#include <sys/un.h>     // For struct sockaddr_un
+#include <netinet/in.h>
+#include <linux/futex.h>
+
+using namespace std;
+
+#include "Channel.h"
+
+static const uint32_t SHM_MAGIC = 0x4E465343;    // "NFSC"
+static const uint32_t SHM_RING_SIZE = 64 * 1024; // bytes per direction, a power of 2
+
+// Segment states
+static const uint32_t SHM_FREE = 0;       // waiting for a shell
+static const uint32_t SHM_ATTACHING = 1;  // a shell claimed the segment
+static const uint32_t SHM_ATTACHED = 2;   // the shell is ready to be accepted
+static const uint32_t SHM_ACTIVE = 3;     // the server accepted the shell
+
+// One direction of a shared-memory channel. head and tail count every byte
+// ever written and read, so head - tail is the number of unread bytes even
+// after the counters wrap.
+struct ShmRing {
+    atomic<uint32_t> head;          // bytes written (producer only)
+    atomic<uint32_t> tail;          // bytes read (consumer only)
+    atomic<uint32_t> seq;           // futex word, bumped after every change
+    atomic<uint32_t> waiters;       // sides sleeping on seq
+    atomic<uint32_t> writer_closed; // producer closed its end
+    atomic<uint32_t> reader_closed; // consumer closed its end
+    char data[SHM_RING_SIZE];
+};
+
+// Layout of the shared-memory object created by the server
+struct ShmSegment {
+    uint32_t magic;                 // SHM_MAGIC once the server set it up
+    int32_t server_pid;             // process that created the segment
+    atomic<uint32_t> state;         // SHM_FREE, ... (futex word for accept)
+    atomic<int32_t> client_pid;     // attached shell, 0 if none
+    ShmRing to_server;              // requests
+    ShmRing to_client;              // responses
+};
+
+static long futex(atomic<uint32_t> *word, int op, uint32_t val, const struct timespec *timeout) {
+    return syscall(SYS_futex, reinterpret_cast<uint32_t *>(word), op, val, timeout, NULL, 0);
+}
+
+// Wakes the other side if it sleeps on ring
+static void ring_notify(ShmRing *ring) {
+    ring->seq.fetch_add(1);
+    if (ring->waiters.load() > 0) {
+        futex(&ring->seq, FUTEX_WAKE, INT_MAX, NULL);
+    }
+}
+
+// Sleeps until ring changes after seq was read. Wakes up every second so
+// a peer that exited without closing is noticed. Returns false on timeout.
+static bool ring_wait(ShmRing *ring, uint32_t seq) {
+    struct timespec timeout = {1, 0};
+    bool woken = true;
+    ring->waiters.fetch_add(1);
+    if (ring->seq.load() == seq &&
+        futex(&ring->seq, FUTEX_WAIT, seq, &timeout) == -1 && errno == ETIMEDOUT) {
+        woken = false;
+    }
+    ring->waiters.fetch_sub(1);
+    return woken;
+}
+
+static void ring_reset(ShmRing *ring) {
+    ring->head.store(0);
+    ring->tail.store(0);
+    ring->writer_closed.store(0);
+    ring->reader_closed.store(0);
+}
+
+static bool process_alive(int pid) {
+    return pid > 0 && (kill(pid, 0) == 0 || errno != ESRCH);
+}
+
+// shm_open names start with a slash
+static string shm_object_name(const string &name) {
+    return "/" + name;
+}
+
+// ---- Channel ----
+
+ssize_t Channel::send_all(const void *buf, size_t len) {
+    struct iovec iov;
+    iov.iov_base = const_cast<void *>(buf);
+    iov.iov_len = len;
+    return sendv(&iov, 1, false);
+}
+
+ssize_t Channel::try_send(const void *buf, size_t len) {
+    return send_all(buf, len);
+}
+
+// ---- SocketChannel ----
+
+SocketChannel::SocketChannel(int sock) : sock(sock) {
+}
+
+// Sends the buffers with one sendmsg() call per attempt (handles partial
+// sends). MSG_MORE lets the kernel coalesce the data with what follows.
+ssize_t SocketChannel::sendv(struct iovec *iov, int iov_count, bool more) {
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = iov;
+    msg.msg_iovlen = iov_count;
+
+    size_t total = 0;
+    size_t len = 0;
+    for (int i = 0; i < iov_count; i++) {
+        len += iov[i].iov_len;
+    }
+    while (total < len) {
+        ssize_t n = sendmsg(sock, &msg, (more ? MSG_MORE : 0) | MSG_NOSIGNAL);
+        if (n == -1) {
+            return -1;
+        }
+        total += n;
+
+        // skip past what was sent
+        while (msg.msg_iovlen > 0 && (size_t) n >= msg.msg_iov[0].iov_len) {
+            n -= msg.msg_iov[0].iov_len;
+            msg.msg_iov++;
+            msg.msg_iovlen--;
+        }
+        if (msg.msg_iovlen > 0) {
+            msg.msg_iov[0].iov_base = (char *) msg.msg_iov[0].iov_base + n;
+            msg.msg_iov[0].iov_len -= n;
+        }
+    }
+    return total;
+}
+
+// Sends the file range with sendfile() so the data never passes through
+// user space.
+ssize_t SocketChannel::send_file(int file_fd, off_t offset, size_t length) {
+    size_t total = 0;
+    while (total < length) {
+        ssize_t n = sendfile(sock, file_fd, &offset, length - total);
+        if (n <= 0) { // 0 means the file ended early
+            return -1;
+        }
+        total += n;
+    }
+    return total;
+}
+
+// One non-blocking send() call; a full socket buffer sends nothing.
+ssize_t SocketChannel::try_send(const void *buf, size_t len) {
+    ssize_t n = send(sock, buf, len, MSG_DONTWAIT | MSG_NOSIGNAL);
+    if (n == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+        return 0;
+    }
+    return n;
+}
+
+ssize_t SocketChannel::recv(void *buf, size_t len) {
+    return ::recv(sock, buf, len, 0);
+}
+
+bool SocketChannel::has_data() {
+    struct pollfd pfd = {sock, POLLIN, 0};
+    return poll(&pfd, 1, 0) > 0;
+}
+
+void SocketChannel::close() {
+    if (sock != -1) {
+        ::close(sock);
+        sock = -1;
+    }
+}
+
+// ---- ShmChannel ----
+
+ShmChannel::ShmChannel(ShmSegment *seg, bool server, void *map, size_t map_len)
+    : seg(seg), in(server ? &seg->to_server : &seg->to_client),
+      out(server ? &seg->to_client : &seg->to_server),
+      server(server), closed(false), map(map), map_len(map_len) {
+}
+
+ShmChannel::~ShmChannel() {
+    close();
+    if (map != NULL) {
+        munmap(map, map_len);
+    }
+}
+
+ShmChannel *ShmChannel::attach(const string &name) {
+    int fd = shm_open(shm_object_name(name).c_str(), O_RDWR, 0);
+    if (fd < 0) {
+        cerr << "Error: No shared-memory server at shm:" << name << "\n";
+        return NULL;
+    }
+    struct stat st;
+    size_t len = sizeof(ShmSegment);
+    if (fstat(fd, &st) < 0 || (size_t) st.st_size < len) {
+        cerr << "Error: shm:" << name << " is not an NFS server segment\n";
+        ::close(fd);
+        return NULL;
+    }
+    void *map = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    ::close(fd); // the mapping stays valid
+    if (map == MAP_FAILED) {
+        cerr << "Error mapping shm:" << name << ": " << strerror(errno) << "\n";
+        return NULL;
+    }
+
+    ShmSegment *seg = static_cast<ShmSegment *>(map);
+    if (seg->magic != SHM_MAGIC || !process_alive(seg->server_pid)) {
+        cerr << "Error: No shared-memory server at shm:" << name << "\n";
+        munmap(map, len);
+        return NULL;
+    }
+    uint32_t expected = SHM_FREE;
+    if (!seg->state.compare_exchange_strong(expected, SHM_ATTACHING)) {
+        cerr << "Error: Server at shm:" << name << " is busy with another client\n";
+        munmap(map, len);
+        return NULL;
+    }
+    seg->client_pid.store(getpid());
+    seg->state.store(SHM_ATTACHED);
+    futex(&seg->state, FUTEX_WAKE, INT_MAX, NULL);
+    return new ShmChannel(seg, false, map, len);
+}
+
+bool ShmChannel::peer_alive() {
+    return process_alive(server ? seg->client_pid.load() : seg->server_pid);
+}
+
+size_t ShmChannel::reserve(char *&dst) {
+    while (true) {
+        uint32_t seq = out->seq.load();
+        if (out->reader_closed.load()) {
+            return 0;
+        }
+        uint32_t head = out->head.load(memory_order_relaxed);
+        uint32_t used = head - out->tail.load();
+        if (used < SHM_RING_SIZE) {
+            uint32_t pos = head & (SHM_RING_SIZE - 1);
+            dst = out->data + pos;
+            return min(SHM_RING_SIZE - used, SHM_RING_SIZE - pos);
+        }
+        if (!ring_wait(out, seq) && !peer_alive()) {
+            return 0;
+        }
+    }
+}
+
+void ShmChannel::publish(size_t n) {
+    out->head.store(out->head.load(memory_order_relaxed) + n);
+    ring_notify(out);
+}
+
+// Copies the buffers into the outgoing ring. The peer polls the ring, so
+// more is not needed to batch anything.
+ssize_t ShmChannel::sendv(struct iovec *iov, int iov_count, bool /* more */) {
+    size_t total = 0;
+    for (int i = 0; i < iov_count; i++) {
+        const char *src = static_cast<const char *>(iov[i].iov_base);
+        size_t left = iov[i].iov_len;
+        while (left > 0) {
+            char *dst;
+            size_t room = reserve(dst);
+            if (room == 0) {
+                errno = EPIPE;
+                return -1;
+            }
+            size_t n = min(room, left);
+            memcpy(dst, src, n);
+            publish(n);
+            src += n;
+            left -= n;
+            total += n;
+        }
+    }
+    return total;
+}
+
+// Reads the file range straight into the outgoing ring.
+ssize_t ShmChannel::send_file(int file_fd, off_t offset, size_t length) {
+    size_t total = 0;
+    while (total < length) {
+        char *dst;
+        size_t room = reserve(dst);
+        if (room == 0) {
+            errno = EPIPE;
+            return -1;
+        }
+        ssize_t n = pread(file_fd, dst, min(room, length - total), offset);
+        if (n <= 0) { // 0 means the file ended early
+            return -1;
+        }
+        publish(n);
+        offset += n;
+        total += n;
+    }
+    return total;
+}
+
+// Copies what fits in the free part of the outgoing ring.
+ssize_t ShmChannel::try_send(const void *buf, size_t len) {
+    if (out->reader_closed.load()) {
+        errno = EPIPE;
+        return -1;
+    }
+    uint32_t head = out->head.load(memory_order_relaxed);
+    uint32_t pos = head & (SHM_RING_SIZE - 1);
+    size_t n = min(len, (size_t) (SHM_RING_SIZE - (head - out->tail.load())));
+    size_t first = min(n, (size_t) (SHM_RING_SIZE - pos)); // up to the end of data
+    memcpy(out->data + pos, buf, first);
+    memcpy(out->data, static_cast<const char *>(buf) + first, n - first);
+    if (n > 0) {
+        publish(n);
+    }
+    return n;
+}
+
+ssize_t ShmChannel::recv(void *buf, size_t len) {
+    while (true) {
+        uint32_t seq = in->seq.load();
+        uint32_t tail = in->tail.load(memory_order_relaxed);
+        uint32_t avail = in->head.load() - tail;
+        if (avail > 0) {
+            uint32_t pos = tail & (SHM_RING_SIZE - 1);
+            size_t n = min((size_t) avail, len);
+            size_t first = min(n, (size_t) (SHM_RING_SIZE - pos)); // up to the end of data
+            memcpy(buf, in->data + pos, first);
+            memcpy(static_cast<char *>(buf) + first, in->data, n - first);
+            in->tail.store(tail + n);
+            ring_notify(in);
+            return n;
+        }
+        if (in->writer_closed.load()) {
+            return 0;
+        }
+        if (!ring_wait(in, seq) && !peer_alive()) {
+            return 0;
+        }
+    }
+}
+
+bool ShmChannel::has_data() {
+    return in->head.load() != in->tail.load(memory_order_relaxed) || in->writer_closed.load();
+}
+
+// Closes both directions. The server end then waits for the shell to
+// detach and frees the segment for the next shell.
+void ShmChannel::close() {
+    if (closed) {
+        return;
+    }
+    closed = true;
+    out->writer_closed.store(1);
+    in->reader_closed.store(1);
+    if (!server) {
+        seg->client_pid.store(0);
+    }
+    ring_notify(out);
+    ring_notify(in);
+    if (!server) {
+        return;
+    }
+
+    while (true) {
+        uint32_t seq = in->seq.load();
+        if (seg->client_pid.load() == 0 || !peer_alive()) {
+            break;
+        }
+        ring_wait(in, seq);
+    }
+    ring_reset(&seg->to_server);
+    ring_reset(&seg->to_client);
+    seg->client_pid.store(0);
+    seg->state.store(SHM_FREE);
+    futex(&seg->state, FUTEX_WAKE, INT_MAX, NULL);
+}
+
+// ---- SocketListener ----
+
+SocketListener::SocketListener(int listen_sock, const string &unix_path)
+    : listen_sock(listen_sock), unix_path(unix_path) {
+}
+
+SocketListener::~SocketListener() {
+    ::close(listen_sock);
+    if (!unix_path.empty()) {
+        unlink(unix_path.c_str());
+    }
+}
+
+SocketListener *SocketListener::listen_tcp(int port) {
+    int listen_sock = socket(AF_INET, SOCK_STREAM, 0);
+    if (listen_sock < 0) {
+        cerr << "Error creating socket" << endl;
+        return NULL;
+    }
+
+    int optval = 1;
+    setsockopt(listen_sock, SOL_SOCKET, SO_REUSEADDR, (const void *)&optval , sizeof(int));
+
+    struct sockaddr_in server_address;
+    memset((char *) &server_address, 0, sizeof(server_address));
+    server_address.sin_family = AF_INET;
+    server_address.sin_addr.s_addr = INADDR_ANY;
+    server_address.sin_port = htons(port);
+
+    if (bind(listen_sock, (struct sockaddr *) &server_address, sizeof(server_address)) < 0) {
+        cerr << "Error binding socket" << endl;
+        ::close(listen_sock);
+        return NULL;
+    }
+
+    if (listen(listen_sock, 5) < 0) {
+        cerr << "Error listening on socket" << endl;
+        ::close(listen_sock);
+        return NULL;
+    }
+    return new SocketListener(listen_sock, "");
+}
+
+SocketListener *SocketListener::listen_unix(const string &path) {
+    struct sockaddr_un server_address;
+    memset(&server_address, 0, sizeof(server_address));
+    server_address.sun_family = AF_UNIX;
+    if (path.empty() || path.length() >= sizeof(server_address.sun_path)) {
+        cerr << "Error: Invalid unix socket path: " << path << endl;
+        return NULL;
+    }
+    strcpy(server_address.sun_path, path.c_str());
+
+    int listen_sock = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listen_sock < 0) {
+        cerr << "Error creating socket" << endl;
+        return NULL;
+    }
+
+    unlink(path.c_str()); // left behind by a server that did not exit cleanly
+    if (bind(listen_sock, (struct sockaddr *) &server_address, sizeof(server_address)) < 0) {
+        cerr << "Error binding socket: " << strerror(errno) << endl;
+        ::close(listen_sock);
+        return NULL;
+    }
+
+    if (listen(listen_sock, 5) < 0) {
+        cerr << "Error listening on socket" << endl;
+        ::close(listen_sock);
+        unlink(path.c_str());
+        return NULL;
+    }
+    return new SocketListener(listen_sock, path);
+}
+
+Channel *SocketListener::accept() {
+    int comm_sock = ::accept(listen_sock, NULL, NULL);
+    if (comm_sock < 0) {
+        cerr << "Error accepting client connection" << endl;
+        return NULL;
+    }
+    return new SocketChannel(comm_sock);
+}
+
+// ---- ShmListener ----
+
+ShmListener::ShmListener(const string &shm_name, ShmSegment *seg, size_t map_len)
+    : shm_name(shm_name), seg(seg), map_len(map_len) {
+}
+
+ShmListener::~ShmListener() {
+    seg->magic = 0;
+    munmap(seg, map_len);
+    shm_unlink(shm_name.c_str());
+}
+
+ShmListener *ShmListener::create(const string &name) {
+    string shm_name = shm_object_name(name);
+    shm_unlink(shm_name.c_str()); // left behind by a server that did not exit cleanly
+    int fd = shm_open(shm_name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+    if (fd < 0) {
+        cerr << "Error creating shared memory shm:" << name << ": " << strerror(errno) << endl;
+        return NULL;
+    }
+    size_t len = sizeof(ShmSegment);
+    void *map = MAP_FAILED;
+    if (ftruncate(fd, len) == 0) { // new pages read as zero
+        map = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    }
+    ::close(fd);
+    if (map == MAP_FAILED) {
+        cerr << "Error mapping shared memory shm:" << name << ": " << strerror(errno) << endl;
+        shm_unlink(shm_name.c_str());
+        return NULL;
+    }
+
+    ShmSegment *seg = static_cast<ShmSegment *>(map);
+    seg->server_pid = getpid();
+    seg->state.store(SHM_FREE);
+    seg->magic = SHM_MAGIC;
+    return new ShmListener(shm_name, seg, len);
+}
+
+Channel *ShmListener::accept() {
+    while (true) {
+        uint32_t state = seg->state.load();
+        if (state == SHM_ATTACHED) {
+            seg->state.store(SHM_ACTIVE);
+            return new ShmChannel(seg, true, NULL, 0);
+        }
+        futex(&seg->state, FUTEX_WAIT, state, NULL);
+    }
+}
@@ -0,0 +1,165 @@
+// CPSC 3500: Channel
+// Byte streams between the shell and the server. Every kind of channel
+// carries the same request/response protocol; only the transport differs.
+
+#ifndef CHANNEL_H
+#define CHANNEL_H
+
+#include <string>
+#include <sys/types.h>
+#include <sys/uio.h>    // For struct iovec
+
+// A connected, bidirectional byte stream.
+class Channel {
+
+  public:
+    virtual ~Channel() {}
+
+    // Sends all iov_count buffers. With more set, the data may be held back
+    // to be sent together with what follows.
+    // Returns -1 on failure, total bytes sent on success.
+    virtual ssize_t sendv(struct iovec *iov, int iov_count, bool more) = 0;
+
+    // Sends length bytes of file_fd starting at offset, without reading
+    // them into a user buffer where the transport allows it.
+    // Returns -1 on failure, total bytes sent on success.
+    virtual ssize_t send_file(int file_fd, off_t offset, size_t length) = 0;
+
+    // Receives up to len bytes into buf. Returns the number of bytes
+    // received, 0 if the peer closed the channel, -1 on error.
+    virtual ssize_t recv(void *buf, size_t len) = 0;
+
+    // Returns true if recv() would return without waiting.
+    virtual bool has_data() = 0;
+
+    // Closes the channel.
+    virtual void close() = 0;
+
+    // Sends all len bytes of buf. Returns -1 on failure, len on success.
+    ssize_t send_all(const void *buf, size_t len);
+
+    // Sends as much of buf as goes without waiting for the peer to read.
+    // Returns the bytes sent (0 if none fit), -1 on failure. Channels
+    // that never wait send it all.
+    virtual ssize_t try_send(const void *buf, size_t len);
+};
+
+// A connected stream socket, TCP or unix domain.
+class SocketChannel : public Channel {
+
+  public:
+    SocketChannel(int sock);
+
+    ssize_t sendv(struct iovec *iov, int iov_count, bool more);
+    ssize_t send_file(int file_fd, off_t offset, size_t length);
+    ssize_t recv(void *buf, size_t len);
+    bool has_data();
+    void close();
+    ssize_t try_send(const void *buf, size_t len);
+
+  private:
+    int sock;   // connected socket, -1 once closed
+};
+
+struct ShmSegment;
+struct ShmRing;
+
+// A shared-memory segment between a shell and a server on the same host.
+// Each direction is a single-producer, single-consumer ring buffer; a side
+// only enters the kernel (futex) when it has to wait for data or space.
+class ShmChannel : public Channel {
+
+  public:
+    // Attaches a shell to the segment the server created for name.
+    // Returns NULL (with the reason on cerr) on failure.
+    static ShmChannel *attach(const std::string &name);
+
+    ~ShmChannel();
+
+    ssize_t sendv(struct iovec *iov, int iov_count, bool more);
+    ssize_t send_file(int file_fd, off_t offset, size_t length);
+    ssize_t recv(void *buf, size_t len);
+    bool has_data();
+    void close();
+    ssize_t try_send(const void *buf, size_t len);
+
+  private:
+    friend class ShmListener;
+
+    ShmChannel(ShmSegment *seg, bool server, void *map, size_t map_len);
+
+    // Waits for room in the outgoing ring. Sets dst to the next free byte
+    // and returns how many bytes may be written there in one piece, or 0 if
+    // the peer is gone.
+    size_t reserve(char *&dst);
+
+    // Makes n bytes written after reserve() visible to the peer.
+    void publish(size_t n);
+
+    // Returns false if the peer process has exited.
+    bool peer_alive();
+
+    ShmSegment *seg;    // shared segment
+    ShmRing *in;        // ring this side reads
+    ShmRing *out;       // ring this side writes
+    bool server;        // true for the server end
+    bool closed;        // true once close() ran
+    void *map;          // mapping owned by this end (shell only)
+    size_t map_len;     // length of map
+};
+
+// Waits for clients at a server location.
+class ChannelListener {
+
+  public:
+    virtual ~ChannelListener() {}
+
+    // Waits for the next client. Returns NULL on failure.
+    virtual Channel *accept() = 0;
+};
+
+// Listens on a TCP port or a unix-domain socket path.
+class SocketListener : public ChannelListener {
+
+  public:
+    // Listens on port of every local address. Returns NULL on failure.
+    static SocketListener *listen_tcp(int port);
+
+    // Listens on the unix-domain socket path, replacing a stale socket
+    // file. Returns NULL on failure.
+    static SocketListener *listen_unix(const std::string &path);
+
+    ~SocketListener();
+
+    Channel *accept();
+
+  private:
+    SocketListener(int listen_sock, const std::string &unix_path);
+
+    int listen_sock;        // listening socket
+    std::string unix_path;  // socket file to remove, empty for TCP
+};
+
+// Serves one shell at a time through a shared-memory segment.
+class ShmListener : public ChannelListener {
+
+  public:
+    // Creates the segment for name, replacing a stale one. Returns NULL on
+    // failure.
+    static ShmListener *create(const std::string &name);
+
+    ~ShmListener();
+
+    // Waits until a shell attaches to the segment. The segment is free for
+    // the next shell once the returned channel is closed.
+    Channel *accept();
+
+  private:
+    ShmListener(const std::string &shm_name, ShmSegment *seg, size_t map_len);
+
+    std::string shm_name;   // name passed to shm_open
+    ShmSegment *seg;        // mapped segment
+    size_t map_len;         // length of the mapping
+};
+
+#endif
@@ -5,84 +5,586 @@
 #include <sys/stat.h>
 #include <unistd.h>
 #include <fcntl.h>
+#include <sys/uio.h>
+#include <sys/file.h>
+#include <climits>
 #include <iostream>
 #include <cstdlib>
+#include <vector>
+#include <algorithm>
+#include <chrono>
+#include <thread>
+#include <sstream>
 using namespace std;
 
 #include "Disk.h"
 #include "Blocks.h"
+#include "Trace.h"
 
-// Opens the file "file_name" that represents the disk.  If the file does
-// not exist, file is created. Returns true if a file is created and false if
-// the file parameter fd exists. Any other error aborts the program.
-bool Disk::mount(const char *file_name)
+typedef chrono::steady_clock Clock;
+
+// Nanoseconds since start
+static long long elapsed_ns(Clock::time_point start)
 {
-  fd = open(file_name, O_RDWR);
-  if (fd != -1) return false;
+  return chrono::duration_cast<chrono::nanoseconds>(Clock::now() - start).count();
+}
 
-  fd = open(file_name, O_RDWR | O_CREAT | O_EXCL, S_IRUSR | S_IWUSR);
-  if (fd == -1) {
-    cerr << "Could not create disk" << endl;
-    exit(-1);
+// Counts a head movement of distance blocks, by the power of two at or
+// below it
+void Disk::note_seek(int distance)
+{
+  unsigned int d = distance < 0 ? -distance : distance;
+  int bucket = 0;
+  while (d > 0 && bucket < DiskStats::SEEK_BUCKETS - 1) {
+    d >>= 1;
+    bucket++;
+  }
+  io_stats.seeks[bucket]++;
+}
+
+// Waits ns nanoseconds. Timer wakeups run tens of microseconds late, so
+// the last SPIN_NS of the wait is spent polling the clock.
+static void wait_ns(long long ns)
+{
+  static const long long SPIN_NS = 100000;
+  Clock::time_point deadline = Clock::now() + chrono::nanoseconds(ns);
+  if (ns > SPIN_NS) {
+    this_thread::sleep_until(deadline - chrono::nanoseconds(SPIN_NS));
+  }
+  while (Clock::now() < deadline) {
+  }
+}
+
+// Adds modeled device time, waiting it out if the model sleeps.
+void Disk::emulate(long long ns)
+{
+  if (ns <= 0) return;
+  io_stats.modeled_ns += ns;
+  if (model.sleeps()) {
+    wait_ns(ns);
+  }
+}
+
+// Every mirror is stamped, past the blocks of its first file, with the
+// generation of the last mount it was in sync for. The mirrors with the
+// newest stamp are in sync; the others missed writes.
+struct mirror_stamp_t {
+  unsigned int magic;		// MIRROR_MAGIC_NUM
+  unsigned int generation;
+};
+static const unsigned int MIRROR_MAGIC_NUM = 0x4E46534D;
+static const off_t STAMP_OFFSET = (off_t) NUM_BLOCKS * BLOCK_SIZE;
+
+// Splits s at every sep
+static vector<string> split(const string &s, char sep)
+{
+  vector<string> parts;
+  size_t start = 0;
+  while (true) {
+    size_t end = s.find(sep, start);
+    parts.push_back(s.substr(start, end - start));
+    if (end == string::npos) return parts;
+    start = end + 1;
+  }
+}
+
+// Parses a disk layout, "files[+files...][:stripe_blocks]".
+bool Disk::parse_layout(const string &layout, vector<vector<string> > &mirror_files,
+                        int &stripe_blocks, string &error)
+{
+  // the superblock records the unit in a byte
+  static const int MAX_STRIPE_BLOCKS = 255;
+
+  string file_list = layout;
+  stripe_blocks = DEFAULT_STRIPE_BLOCKS;
+  size_t colon = layout.rfind(':');
+  if (colon != string::npos) {
+    file_list = layout.substr(0, colon);
+    char *end = NULL;
+    long blocks = strtol(layout.c_str() + colon + 1, &end, 10);
+    if (colon + 1 == layout.length() || *end != '\0' || blocks < 1 || blocks > MAX_STRIPE_BLOCKS) {
+      error = "stripe unit of \"" + layout + "\" must be 1 to " + to_string(MAX_STRIPE_BLOCKS) +
+              " blocks";
+      return false;
+    }
+    stripe_blocks = blocks;
   }
 
+  mirror_files.clear();
+  vector<string> sets = split(file_list, '+');
+  if (sets.size() > (size_t) MAX_MIRRORS) {
+    error = "disk \"" + layout + "\" has more than " + to_string(MAX_MIRRORS) + " mirrors";
+    return false;
+  }
+  for (size_t m = 0; m < sets.size(); m++) {
+    mirror_files.push_back(split(sets[m], ','));
+    const vector<string> &files = mirror_files.back();
+    for (size_t i = 0; i < files.size(); i++) {
+      if (files[i].empty()) {
+        error = "empty file name in disk \"" + layout + "\"";
+        return false;
+      }
+    }
+    if (files.size() > (size_t) MAX_STRIPE_FILES) {
+      error = "disk \"" + layout + "\" has more than " + to_string(MAX_STRIPE_FILES) + " files";
+      return false;
+    }
+    if (files.size() != mirror_files[0].size()) {
+      error = "mirrors of disk \"" + layout + "\" must have as many files each";
+      return false;
+    }
+  }
   return true;
 }
 
-// Closes the file descriptor that represents the disk.
-void Disk::unmount()
+Disk::Disk() : stopping(false) {}
+
+Disk::~Disk()
 {
-  close(fd);
+  stopping = true;
+  if (resync_thread.joinable()) {
+    resync_thread.join();
+  }
 }
-  
-// Reads disk block block_num from the disk into block.
-void Disk::read_block(int block_num, void *block)
+
+// Opens the files of layout that represent the disk.  If the files do not
+// exist, they are created. Returns true if they are created and false if
+// they exist. The disk is locked for as long as it is mounted, so two
+// mounts (e.g. two servers, or one volume exported twice) cannot overwrite
+// each other's blocks. A mirror missing some of its files, or stamped with
+// an older generation than the newest, is brought up to date in the
+// background. Any other error aborts the program.
+bool Disk::mount(const char *layout)
 {
-  off_t offset;
-  off_t new_offset;
-  ssize_t size; 
+  vector<vector<string> > names;
+  string error;
+  if (!parse_layout(layout, names, unit_blocks, error)) {
+    cerr << "Invalid disk: " << error << endl;
+    exit(-1);
+  }
 
-  if (block_num < 0 || block_num >= NUM_BLOCKS) {
-    cerr << "Invalid block size" << endl;
+  files = names[0].size();
+  mirrors.assign(names.size(), Mirror());
+  size_t missing = 0;
+  for (size_t m = 0; m < mirrors.size(); m++) {
+    Mirror &mirror = mirrors[m];
+    mirror.names = names[m];
+    mirror.fds.assign(files, -1);
+    mirror.heads.assign(files, 0);
+    mirror.state = IN_SYNC;
+    mirror.resync_next = 0;
+    mirror.backlog_ns = 0;
+    mirror.reads = 0;
+    for (int f = 0; f < files; f++) {
+      mirror.fds[f] = open(mirror.names[f].c_str(), O_RDWR);
+      if (mirror.fds[f] == -1) missing++;
+    }
+  }
+  bool created = missing == mirrors.size() * files;
+
+  // the stamp of every mirror with all of its files, -1 for the others
+  long long newest = created ? 0 : -1;
+  vector<long long> stamps(mirrors.size(), -1);
+  for (size_t m = 0; m < mirrors.size(); m++) {
+    Mirror &mirror = mirrors[m];
+    bool complete = true;
+    for (int f = 0; f < files; f++) {
+      if (mirror.fds[f] == -1) {
+        mirror.fds[f] = open(mirror.names[f].c_str(), O_RDWR | O_CREAT | O_EXCL, S_IRUSR | S_IWUSR);
+        if (mirror.fds[f] == -1) {
+          cerr << "Could not create disk" << endl;
+          exit(-1);
+        }
+        complete = false;
+      }
+      if (flock(mirror.fds[f], LOCK_EX | LOCK_NB) == -1) {
+        cerr << "Disk " << mirror.names[f] << " is in use by another mount" << endl;
+        exit(-1);
+      }
+    }
+    if (complete && !created) {
+      // disks from before mirroring have no stamp: generation 0
+      mirror_stamp_t stamp;
+      ssize_t size = pread(mirror.fds[0], &stamp, sizeof(stamp), STAMP_OFFSET);
+      bool stamped = size == sizeof(stamp) && stamp.magic == MIRROR_MAGIC_NUM;
+      stamps[m] = stamped ? stamp.generation : 0;
+      newest = max(newest, stamps[m]);
+    }
+  }
+  if (newest < 0) {
+    cerr << "Disk " << layout << " is missing some of its files" << endl;
     exit(-1);
   }
 
-  offset = block_num * BLOCK_SIZE;
-  new_offset = lseek(fd, offset, SEEK_SET);
-  if (offset != new_offset) {
-    cerr << "Seek failure" << endl;
+  generation = newest + 1;
+  bool behind = false;
+  for (size_t m = 0; m < mirrors.size(); m++) {
+    if (created || stamps[m] == newest) {
+      stamp_mirror(m);
+    } else {
+      mirrors[m].state = RESYNCING;
+      behind = true;
+      cerr << "Mirror " << mirrors[m].names[0] << " is behind; resyncing it" << endl;
+    }
+  }
+  if (behind) {
+    stopping = false;
+    resync_thread = thread(&Disk::resync, this);
+  }
+
+  return created;
+}
+
+// Closes the file descriptors that represent the disk.
+void Disk::unmount()
+{
+  stopping = true;
+  if (resync_thread.joinable()) {
+    resync_thread.join();
+  }
+  for (size_t m = 0; m < mirrors.size(); m++) {
+    for (int f = 0; f < files; f++) {
+      close(mirrors[m].fds[f]);
+    }
+  }
+  mirrors.clear();
+}
+
+// Records generation in mirror m.
+void Disk::stamp_mirror(int m)
+{
+  mirror_stamp_t stamp = { MIRROR_MAGIC_NUM, generation };
+  if (pwrite(mirrors[m].fds[0], &stamp, sizeof(stamp), STAMP_OFFSET) != sizeof(stamp)) {
+    cerr << "Failed to stamp mirror " << mirrors[m].names[0] << endl;
     exit(-1);
   }
+}
 
-  size = read(fd, block, BLOCK_SIZE);
-  if (size != BLOCK_SIZE) {
-    cerr << "Failed to read entire block" << endl;
+// Takes mirror m out of use after an I/O error. The mirrors left in sync
+// move on a generation, so m is resynced when it is next mounted.
+void Disk::fail_mirror(int m, const char *what)
+{
+  mirrors[m].state = FAILED;
+  bool any_in_sync = false;
+  for (size_t i = 0; i < mirrors.size(); i++) {
+    any_in_sync = any_in_sync || mirrors[i].state == IN_SYNC;
+  }
+  if (!any_in_sync) {
+    cerr << what << endl;
     exit(-1);
   }
+  cerr << what << " on mirror " << mirrors[m].names[0] << "; continuing without it" << endl;
+  generation++;
+  for (size_t i = 0; i < mirrors.size(); i++) {
+    if (mirrors[i].state == IN_SYNC) {
+      stamp_mirror(i);
+    }
+  }
 }
 
-// Writes the data in block to disk block block_num.
-void Disk::write_block(int block_num, void *block)
+string Disk::mirror_status()
 {
-  off_t offset;
-  off_t new_offset;
-  ssize_t size; 
+  lock_guard<mutex> guard(lock);
+  stringstream ss;
+  for (size_t m = 0; m < mirrors.size(); m++) {
+    const Mirror &mirror = mirrors[m];
+    ss << (m > 0 ? ", " : "") << mirror.names[0] << (files > 1 ? ",...: " : ": ");
+    if (mirror.state == IN_SYNC) {
+      ss << "in sync, " << mirror.reads << " reads";
+    } else if (mirror.state == RESYNCING) {
+      ss << "resyncing, " << 100 * mirror.resync_next / NUM_BLOCKS << "% copied";
+    } else {
+      ss << "failed";
+    }
+  }
+  return ss.str();
+}
+
+// Copies every mirror that is behind from one in sync, a chunk of blocks
+// at a time. Requests write through to the blocks already copied and wait
+// for at most one chunk. With a model, the copy takes the time it would on
+// the devices, as backlog that steers reads to other mirrors meanwhile.
+void Disk::resync()
+{
+  static const int RESYNC_CHUNK = 16;
+  while (!stopping) {
+    int source = -1, target = -1;
+    long long chunk_ns = 0;
+    bool sleeps = false;
+    {
+      lock_guard<mutex> guard(lock);
+      for (size_t m = 0; m < mirrors.size(); m++) {
+        if (mirrors[m].state == RESYNCING && target == -1) {
+          target = m;
+        } else if (mirrors[m].state == IN_SYNC &&
+                   (source == -1 || mirrors[m].backlog_ns < mirrors[source].backlog_ns)) {
+          source = m;
+        }
+      }
+      if (target == -1) {
+        return;
+      }
+      Mirror &from = mirrors[source];
+      Mirror &to = mirrors[target];
+      int first = to.resync_next;
+      int last = min(first + RESYNC_CHUNK, NUM_BLOCKS);
+      char block[BLOCK_SIZE];
+      bool copied = true;
+      for (int b = first; copied && b < last; b++) {
+        int file, file_block;
+        locate(b, file, file_block);
+        off_t offset = (off_t) file_block * BLOCK_SIZE;
+        if (pread(from.fds[file], block, BLOCK_SIZE, offset) != BLOCK_SIZE) {
+          fail_mirror(source, "Failed to read entire block");
+          copied = false;
+        } else if (pwrite(to.fds[file], block, BLOCK_SIZE, offset) != BLOCK_SIZE) {
+          cerr << "Failed to write entire block on mirror " << to.names[0] << "; not resyncing it" << endl;
+          to.state = FAILED;
+          copied = false;
+        }
+      }
+      if (!copied) {
+        continue;
+      }
+
+      to.resync_next = last;
+      if (last == NUM_BLOCKS) {
+        to.state = IN_SYNC;
+        stamp_mirror(target);
+        cerr << "Mirror " << to.names[0] << " is in sync" << endl;
+      }
+      int sequential = 0;
+      chunk_ns = model.service_ns(&sequential, 1, (size_t) (last - first) * BLOCK_SIZE);
+      from.backlog_ns += chunk_ns;
+      to.backlog_ns += chunk_ns;
+      sleeps = model.sleeps();
+    }
 
+    // the devices are busy with the chunk; requests may use the disk
+    if (chunk_ns > 0) {
+      if (sleeps) {
+        wait_ns(chunk_ns);
+      }
+      lock_guard<mutex> guard(lock);
+      mirrors[source].backlog_ns -= chunk_ns;
+      mirrors[target].backlog_ns -= chunk_ns;
+    }
+    this_thread::yield();
+  }
+}
+
+// Finds the file and the block within it that hold block_num.
+void Disk::locate(int block_num, int &file, int &file_block)
+{
   if (block_num < 0 || block_num >= NUM_BLOCKS) {
     cerr << "Invalid block size" << endl;
     exit(-1);
   }
+  int unit = block_num / unit_blocks;
+  file = unit % files;
+  file_block = (unit / files) * unit_blocks + block_num % unit_blocks;
+}
 
-  offset = block_num * BLOCK_SIZE;
-  new_offset = lseek(fd, offset, SEEK_SET);
-  if (offset != new_offset) {
-    cerr << "Seek failure" << endl;
+// Picks the in-sync mirror that would finish reading bytes at file_block
+// of file the soonest: its resync backlog, plus what it already has to do
+// for this request, plus the read itself from where its head is. Ties go
+// to the mirror that has served the fewest reads.
+int Disk::pick_mirror(int file, int file_block, size_t bytes, const long long *pending_ns)
+{
+  int best = -1;
+  long long best_ns = 0;
+  for (size_t m = 0; m < mirrors.size(); m++) {
+    const Mirror &mirror = mirrors[m];
+    if (mirror.state != IN_SYNC) continue;
+    int distance = file_block - mirror.heads[file];
+    long long ns = mirror.backlog_ns + model.service_ns(&distance, 1, bytes);
+    if (pending_ns != NULL) {
+      ns += pending_ns[m * files + file];
+    }
+    if (best == -1 || ns < best_ns || (ns == best_ns && mirror.reads < mirrors[best].reads)) {
+      best = m;
+      best_ns = ns;
+    }
+  }
+  return best;
+}
+  
+// Reads disk block block_num from the disk into block.
+void Disk::read_block(int block_num, void *block)
+{
+  if (block_num < 0 || block_num >= NUM_BLOCKS) {
+    cerr << "Invalid block size" << endl;
     exit(-1);
   }
+  short block_nums[1] = { (short) block_num };
 
-  size = write(fd, block, BLOCK_SIZE);
-  if (size != BLOCK_SIZE) {
-    cerr << "Failed to write entire block" << endl;
+  TraceScope span("disk read", block_num, 1);
+  Clock::time_point start = Clock::now();
+  emulate(transfer(block_nums, 1, block, false));
+  io_stats.reads.record(elapsed_ns(start));
+  io_stats.blocks_read++;
+}
+
+// Writes the data in block to disk block block_num.
+void Disk::write_block(int block_num, void *block)
+{
+  if (block_num < 0 || block_num >= NUM_BLOCKS) {
+    cerr << "Invalid block size" << endl;
     exit(-1);
   }
+  short block_nums[1] = { (short) block_num };
+
+  TraceScope span("disk write", block_num, 1);
+  Clock::time_point start = Clock::now();
+  emulate(transfer(block_nums, 1, block, true));
+  io_stats.writes.record(elapsed_ns(start));
+  io_stats.blocks_written++;
+}
+
+// Returns the file descriptor and file offset at which block_num is
+// stored, for transfers that bypass read_block (e.g. sendfile), and how
+// many blocks from block_num on follow it in that file. The file is that
+// of the mirror a read would go to.
+int Disk::map_block(int block_num, int &block_fd, off_t &offset)
+{
+  int file, file_block;
+  locate(block_num, file, file_block);
+  lock_guard<mutex> guard(lock);
+  int m = pick_mirror(file, file_block, BLOCK_SIZE, NULL);
+  mirrors[m].reads++;
+  block_fd = mirrors[m].fds[file];
+  offset = (off_t) file_block * BLOCK_SIZE;
+  if (files == 1) {
+    return NUM_BLOCKS - block_num;
+  }
+  return unit_blocks - block_num % unit_blocks;
+}
+
+// Orders requests by where their blocks are stored: by file, then by
+// block within the file.
+struct BlockOrder {
+  const int *files;
+  const int *file_blocks;
+  bool operator()(int a, int b) const {
+    if (files[a] != files[b]) return files[a] < files[b];
+    return file_blocks[a] < file_blocks[b];
+  }
+};
+
+// Reads or writes count blocks, block_nums[i] at blocks + i * BLOCK_SIZE.
+// The requests are sorted by where they are stored and each run of blocks
+// consecutive in one file is moved with one preadv() or pwritev() straight
+// to or from place: a write to every mirror, a read from the mirror picked
+// for it. The files of every mirror are separate devices working at once,
+// so the request takes as long as the busiest of them. A mirror being
+// resynced gets only the blocks it already has, and its writes are not
+// modeled (the resync is charged for them).
+long long Disk::transfer(const short *block_nums, int count, void *blocks, bool write)
+{
+  vector<int> order(count), in_file(count), file_blocks(count);
+  for (int i = 0; i < count; i++) {
+    locate(block_nums[i], in_file[i], file_blocks[i]);
+    order[i] = i;
+  }
+  BlockOrder by_place = { in_file.data(), file_blocks.data() };
+  sort(order.begin(), order.end(), by_place);
+
+  lock_guard<mutex> guard(lock);
+  int devices = mirrors.size() * files;
+  vector<vector<int> > distances(devices); // per device, head movement to each run
+  vector<size_t> bytes(devices);
+  vector<long long> pending_ns(devices);   // per device, modeled time of its runs so far
+  vector<struct iovec> iov;
+  int run_start = 0;
+  while (run_start < count) {
+    // extend the run while blocks are consecutive in the same file
+    int file = in_file[order[run_start]];
+    int run_end = run_start + 1;
+    while (run_end < count && run_end - run_start < IOV_MAX && in_file[order[run_end]] == file &&
+           file_blocks[order[run_end]] == file_blocks[order[run_end - 1]] + 1) {
+      run_end++;
+    }
+
+    iov.resize(run_end - run_start);
+    for (int i = run_start; i < run_end; i++) {
+      iov[i - run_start].iov_base = (char *) blocks + order[i] * BLOCK_SIZE;
+      iov[i - run_start].iov_len = BLOCK_SIZE;
+    }
+
+    int first = file_blocks[order[run_start]];
+    off_t offset = (off_t) first * BLOCK_SIZE;
+    ssize_t expected = (ssize_t) (run_end - run_start) * BLOCK_SIZE;
+
+    // counts the run against the device that is file of mirror m
+    auto account = [&](int m) {
+      int device = m * files + file;
+      distances[device].push_back(first - mirrors[m].heads[file]);
+      note_seek(distances[device].back());
+      mirrors[m].heads[file] = file_blocks[order[run_end - 1]] + 1;
+      bytes[device] += expected;
+      pending_ns[device] += model.service_ns(&distances[device].back(), 1, expected);
+    };
+
+    if (!write) {
+      // one mirror serves the run, another if it fails
+      int m = pick_mirror(file, first, expected, pending_ns.data());
+      while (preadv(mirrors[m].fds[file], iov.data(), iov.size(), offset) != expected) {
+        fail_mirror(m, "Failed to read entire block");
+        m = pick_mirror(file, first, expected, pending_ns.data());
+      }
+      mirrors[m].reads++;
+      account(m);
+    }
+
+    for (size_t m = 0; write && m < mirrors.size(); m++) {
+      Mirror &mirror = mirrors[m];
+      if (mirror.state == IN_SYNC) {
+        if (pwritev(mirror.fds[file], iov.data(), iov.size(), offset) != expected) {
+          fail_mirror(m, "Failed to write entire block");
+        } else {
+          account(m);
+        }
+      } else if (mirror.state == RESYNCING) {
+        // only the blocks resync has already copied; it copies the rest
+        for (int i = run_start; mirror.state == RESYNCING && i < run_end; i++) {
+          if (block_nums[order[i]] < mirror.resync_next &&
+              pwrite(mirror.fds[file], iov[i - run_start].iov_base, BLOCK_SIZE,
+                     (off_t) file_blocks[order[i]] * BLOCK_SIZE) != BLOCK_SIZE) {
+            cerr << "Failed to write entire block on mirror " << mirror.names[0]
+                 << "; not resyncing it" << endl;
+            mirror.state = FAILED;
+          }
+        }
+      }
+    }
+    run_start = run_end;
+  }
+
+  long long busiest_ns = 0;
+  for (int d = 0; d < devices; d++) {
+    if (!distances[d].empty()) {
+      busiest_ns = max(busiest_ns, model.service_ns(distances[d].data(), distances[d].size(), bytes[d]));
+    }
+  }
+  return busiest_ns;
+}
+
+// Reads count blocks, block_nums[i] into blocks + i * BLOCK_SIZE.
+void Disk::read_blocks(const short *block_nums, int count, void *blocks)
+{
+  TraceScope span("disk read", count > 0 ? block_nums[0] : -1, count);
+  Clock::time_point start = Clock::now();
+  emulate(transfer(block_nums, count, blocks, false));
+  io_stats.reads.record(elapsed_ns(start));
+  io_stats.blocks_read += count;
+}
+
+// Writes count blocks, blocks + i * BLOCK_SIZE to block_nums[i].
+void Disk::write_blocks(const short *block_nums, int count, void *blocks)
+{
+  TraceScope span("disk write", count > 0 ? block_nums[0] : -1, count);
+  Clock::time_point start = Clock::now();
+  emulate(transfer(block_nums, count, blocks, true));
+  io_stats.writes.record(elapsed_ns(start));
+  io_stats.blocks_written += count;
 }
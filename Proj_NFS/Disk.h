@@ -4,16 +4,92 @@
 #ifndef DISK_H
 #define DISK_H
 
+#include <sys/types.h>
+#include <string>
+#include <vector>
+#include <mutex>
+#include <thread>
+#include <atomic>
+#include "Metrics.h"
+#include "DiskModel.h"
+
+// Disk requests made so far and how long they took. A batched request
+// counts once, with all of its blocks.
+struct DiskStats {
+    LatencyHistogram reads;     // read_block and read_blocks calls
+    LatencyHistogram writes;    // write_block and write_blocks calls
+    long long blocks_read;
+    long long blocks_written;
+
+    // Head movements by distance in blocks: seeks[0] counts runs that
+    // start where the last one ended, seeks[i] distances of 2^(i-1) up to
+    // 2^i - 1 blocks
+    static const int SEEK_BUCKETS = 14;
+    long long seeks[SEEK_BUCKETS];
+
+    long long modeled_ns;       // device time added by the disk model
+
+    DiskStats() : blocks_read(0), blocks_written(0), seeks(), modeled_ns(0) {}
+};
+
+// The disk is one file, or is striped (RAID-0 style) over several: block
+// b lies in stripe unit b / stripe_blocks, and unit u in file u % files.
+// Every file stands for a separate device with its own head, so the runs
+// of a batched request that fall in different files overlap.
+//
+// The disk may also be mirrored (RAID-1 style): every mirror holds all of
+// the blocks, laid out the same way over its own files. Writes go to every
+// mirror; each read goes to the mirror that would serve it soonest. A
+// mirror that is new, lost files or missed writes while it was not mounted
+// is copied from one in sync by a background thread, which locks the disk
+// for one chunk of blocks at a time.
 class Disk {
 
   public:
-    // Opens the file "file_name" that represents the disk.  If the file does
-    // not exist, file is created. Returns true if a file is created and false if
-    // the file parameter fd exists. Any other error aborts the program.
-    bool mount(const char *filename);
+    // Blocks per stripe unit when a layout does not give one
+    static const int DEFAULT_STRIPE_BLOCKS = 4;
+
+    // Most files a disk can be striped over
+    static const int MAX_STRIPE_FILES = 16;
+
+    // Most mirrors of a disk
+    static const int MAX_MIRRORS = 4;
 
-    // Closes the file descriptor that represents the disk.
+    // Parses a disk layout, "files[+files...][:stripe_blocks]", where files
+    // is "file[,file...]" and every "+" adds a mirror striped over as many
+    // files. mirrors[m] gets the files of mirror m. Returns false, with the
+    // reason in error, for an invalid layout.
+    static bool parse_layout(const std::string &layout,
+                             std::vector<std::vector<std::string> > &mirrors,
+                             int &stripe_blocks, std::string &error);
+
+    Disk();
+
+    // Stops a resync in progress.
+    ~Disk();
+
+    // Opens the files of layout (see parse_layout) that represent the disk.
+    // If they do not exist, they are created. Returns true if they are
+    // created and false if they exist. Mirrors that are behind are resynced
+    // in the background. Any other error (an invalid layout, no mirror with
+    // all of its files) aborts the program.
+    bool mount(const char *layout);
+
+    // Closes the file descriptors that represent the disk. A resync in
+    // progress stops, and starts over at the next mount.
     void unmount();
+
+    // Number of files the blocks are striped over (1 if not striped).
+    int stripe_files() const { return files; }
+
+    // Blocks per stripe unit.
+    int stripe_blocks() const { return unit_blocks; }
+
+    // Number of mirrors (1 if not mirrored).
+    int mirror_count() const { return mirrors.size(); }
+
+    // Describes the state of every mirror and the reads it served.
+    std::string mirror_status();
   
     // Reads disk block block_num from the disk into block.
     void read_block(int block_num, void *block);
@@ -21,8 +97,85 @@ class Disk {
     // Writes the data in block to disk block block_num.
     void write_block(int block_num, void *block);
 
+    // Returns the file descriptor and file offset at which block_num is
+    // stored, for transfers that bypass read_block (e.g. sendfile), and
+    // how many blocks from block_num on follow it in that file (to the end
+    // of its stripe unit).
+    int map_block(int block_num, int &block_fd, off_t &offset);
+
+    // Reads count blocks, block_nums[i] into blocks + i * BLOCK_SIZE.
+    // Runs of blocks consecutive in one file are read with a single system
+    // call.
+    void read_blocks(const short *block_nums, int count, void *blocks);
+
+    // Writes count blocks, blocks + i * BLOCK_SIZE to block_nums[i].
+    // Runs of blocks consecutive in one file are written with a single system
+    // call.
+    void write_blocks(const short *block_nums, int count, void *blocks);
+
+    // Requests made since the disk was created.
+    const DiskStats &stats() const { return io_stats; }
+
+    // Makes every I/O cost what it would on the emulated device (none by
+    // default).
+    void set_model(const DiskModel &device) {
+        std::lock_guard<std::mutex> guard(lock);
+        model = device;
+    }
+
   private:
-    int fd;	// file descriptor that represents the disk
+    enum MirrorState { IN_SYNC, RESYNCING, FAILED };
+
+    struct Mirror {
+        std::vector<std::string> names; // its files
+        std::vector<int> fds;           // file descriptors of its files
+        std::vector<int> heads;         // per file, block after the last one transferred
+        MirrorState state;
+        int resync_next;                // RESYNCING: blocks below this are copied
+        long long backlog_ns;           // modeled time of resync I/O not yet over
+        long long reads;                // runs of blocks read from it
+    };
+
+    std::vector<Mirror> mirrors;
+    int files = 1;	// files per mirror
+    int unit_blocks = DEFAULT_STRIPE_BLOCKS;	// blocks per stripe unit
+    unsigned int generation = 0;	// stamped on mirrors in sync
+    DiskStats io_stats;
+    DiskModel model;	// emulated device, one per file
+    std::mutex lock;	// mirrors, between requests and the resync thread
+    std::thread resync_thread;
+    std::atomic<bool> stopping;
+
+    // Finds the file (index into a mirror's fds) and the block within it
+    // that hold block_num. Aborts the program for a block number out of
+    // range.
+    void locate(int block_num, int &file, int &file_block);
+
+    // Reads or writes count blocks with one system call per run of blocks
+    // that are consecutive in one file. Returns the modeled time.
+    long long transfer(const short *block_nums, int count, void *blocks, bool write);
+
+    // Picks the in-sync mirror that would finish reading bytes at
+    // file_block of file the soonest, given the modeled time
+    // pending_ns[m * files + file] (if not NULL) each file already has in
+    // this request. Returns -1 if none is in sync.
+    int pick_mirror(int file, int file_block, size_t bytes, const long long *pending_ns);
+
+    // Takes mirror m out of use after the I/O error what. Aborts the
+    // program if it was the last mirror in sync.
+    void fail_mirror(int m, const char *what);
+
+    // Records generation in mirror m, marking it in sync as of this mount.
+    void stamp_mirror(int m);
+
+    // Body of the resync thread: copies every mirror that is behind.
+    void resync();
+
+    // Counts a head movement of distance blocks.
+    void note_seek(int distance);
+
+    // Adds ns of modeled device time, waiting it out if the model sleeps.
+    void emulate(long long ns);
 };
 
 #endif
@@ -0,0 +1,100 @@
+// CPSC 3500: DiskModel
+// Service times of an emulated hard disk or SSD.
+
+#include <cmath>
+#include <cstdlib>
+#include <sstream>
+
+using namespace std;
+
+#include "DiskModel.h"
+#include "Blocks.h"
+
+DiskModel::DiskModel()
+    : model_kind(NONE), latency_us(80), queue_depth(32), seek_ms(15), min_seek_ms(1),
+      rpm(7200), mbps(500), sleep(true) {}
+
+bool DiskModel::parse(const string &spec, DiskModel &model, string &error) {
+    model = DiskModel();
+    stringstream ss(spec);
+    string kind;
+    getline(ss, kind, ',');
+    if (kind == "none") {
+        model.model_kind = NONE;
+    } else if (kind == "ssd") {
+        model.model_kind = SSD;
+    } else if (kind == "hdd") {
+        model.model_kind = HDD;
+        model.mbps = 150;
+    } else {
+        error = "unknown disk model \"" + kind + "\" (none, ssd or hdd)";
+        return false;
+    }
+
+    string setting;
+    while (getline(ss, setting, ',')) {
+        size_t equals = setting.find('=');
+        string key = setting.substr(0, equals);
+        char *end = NULL;
+        double value = equals == string::npos ? -1 : strtod(setting.c_str() + equals + 1, &end);
+        if (equals == string::npos || *end != '\0' || value < 0) {
+            error = "invalid disk model setting \"" + setting + "\"";
+            return false;
+        }
+        if (key == "sleep") {
+            model.sleep = value != 0;
+        } else if (model.model_kind == SSD && key == "latency_us") {
+            model.latency_us = value;
+        } else if (model.model_kind == SSD && key == "qd" && value >= 1) {
+            model.queue_depth = (int) value;
+        } else if (model.model_kind == HDD && key == "seek_ms") {
+            model.seek_ms = value;
+        } else if (model.model_kind == HDD && key == "min_seek_ms") {
+            model.min_seek_ms = value;
+        } else if (model.model_kind == HDD && key == "rpm" && value > 0) {
+            model.rpm = value;
+        } else if (model.model_kind != NONE && key == "mbps" && value > 0) {
+            model.mbps = value;
+        } else {
+            error = "invalid disk model setting \"" + setting + "\" for " + kind;
+            return false;
+        }
+    }
+    return true;
+}
+
+// An SSD pays its latency once per queue_depth runs, since it works on
+// that many at once. A hard disk pays, for every run it has to seek to, a
+// seek that grows with the square root of the distance (the arm
+// accelerates, then coasts) and on average half a rotation.
+long long DiskModel::service_ns(const int *distances, int runs, size_t bytes) const {
+    if (model_kind == NONE) {
+        return 0;
+    }
+    double ns = bytes * 1000.0 / mbps; // 1 MB/s moves one byte per microsecond
+    if (model_kind == SSD) {
+        ns += latency_us * 1000 * ((runs + queue_depth - 1) / queue_depth);
+    } else {
+        double half_rotation_ns = 30000.0 / rpm * 1000000;
+        for (int i = 0; i < runs; i++) {
+            if (distances[i] != 0) {
+                double stroke = sqrt((double) abs(distances[i]) / NUM_BLOCKS);
+                ns += (min_seek_ms + (seek_ms - min_seek_ms) * stroke) * 1000000 + half_rotation_ns;
+            }
+        }
+    }
+    return (long long) ns;
+}
+
+string DiskModel::describe() const {
+    stringstream ss;
+    if (model_kind == NONE) {
+        return "none";
+    } else if (model_kind == SSD) {
+        ss << "ssd, latency " << latency_us << " us, queue depth " << queue_depth;
+    } else {
+        ss << "hdd, seek " << min_seek_ms << "-" << seek_ms << " ms, " << rpm << " rpm";
+    }
+    ss << ", " << mbps << " MB/s" << (sleep ? "" : ", modeled time only");
+    return ss.str();
+}
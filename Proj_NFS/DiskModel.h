@@ -0,0 +1,56 @@
+// CPSC 3500: DiskModel
+// Service times of an emulated device. The disk file is served from the
+// page cache, so on its own every block costs about the same; with a
+// model, Disk adds what the I/O would have cost on a hard disk (seek and
+// rotation, by block distance) or an SSD (fixed latency, overlapped up to
+// a queue depth), plus the transfer at a limited bandwidth.
+
+#ifndef DISK_MODEL_H
+#define DISK_MODEL_H
+
+#include <string>
+#include <cstddef>
+
+class DiskModel {
+
+  public:
+    enum Kind { NONE, SSD, HDD };
+
+    // No emulation: every I/O is free.
+    DiskModel();
+
+    // Parses a model spec, "none", "ssd" or "hdd", optionally followed by
+    // ",key=value" settings:
+    //   ssd: latency_us (80), mbps (500), qd (32)
+    //   hdd: seek_ms (full-stroke seek, 15), min_seek_ms (1), rpm (7200),
+    //        mbps (150)
+    //   both: sleep (1; 0 only counts the modeled time, for reproducible
+    //         numbers without waiting)
+    // Returns false, with the reason in error, for an invalid spec.
+    static bool parse(const std::string &spec, DiskModel &model, std::string &error);
+
+    Kind kind() const { return model_kind; }
+
+    // True if Disk should wait out the modeled time.
+    bool sleeps() const { return sleep; }
+
+    // Modeled time in ns of one request made of runs runs of consecutive
+    // blocks, bytes in all. distances[i] is how many blocks the head moves
+    // to reach run i (0 if it follows on from where the last I/O ended).
+    long long service_ns(const int *distances, int runs, size_t bytes) const;
+
+    // Describes the model and its settings, e.g. for a log line.
+    std::string describe() const;
+
+  private:
+    Kind model_kind;
+    double latency_us;      // ssd: per-request latency
+    int queue_depth;        // ssd: requests serviced at once
+    double seek_ms;         // hdd: full-stroke seek
+    double min_seek_ms;     // hdd: track-to-track seek
+    double rpm;             // hdd: spindle speed
+    double mbps;            // transfer rate, MB/s
+    bool sleep;
+};
+
+#endif
@@ -0,0 +1,438 @@
+// CPSC 3500: Dispatch
+// Reads client requests, runs them against the file system and sends the
+// responses.
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <cstring>      // For strerror
+#include <errno.h>
+#include <sstream>      // For stringstream parsing
+#include <algorithm>    // For std::min
+#include <chrono>
+
+#include "Dispatch.h"
+using namespace std;
+
+// Helper function to send a response: the header and the body left in fs
+// by the last command. Body bytes in memory go out with one sendv() per
+// piece (the header rides along with the first piece); body extents that
+// FileSys left on the disk go out with send_file(). With more set, the
+// channel may hold the end of the response back to coalesce it with the
+// next one.
+// Returns -1 on failure, total bytes sent on success; bytes sent with
+// send_file are added to zero_copy_bytes.
+ssize_t send_response(Channel &channel, const string &header, FileSys &fs, bool more,
+                      size_t &zero_copy_bytes) {
+    const string &body = fs.body();
+    const vector<FileSys::DiskExtent> &extents = fs.body_extents();
+
+    struct iovec iov[2];
+    iov[0].iov_base = (void *) header.data();
+    iov[0].iov_len = header.length();
+    int iov_count = 1;
+
+    size_t total = 0;
+    size_t body_pos = 0;
+    for (size_t i = 0; i <= extents.size(); i++) {
+        // body bytes in memory up to the next extent (or the end)
+        bool last = (i == extents.size());
+        size_t end = last ? body.length() : extents[i].body_offset;
+        iov[iov_count].iov_base = (void *) (body.data() + body_pos);
+        iov[iov_count].iov_len = end - body_pos;
+        iov_count++;
+
+        ssize_t n = channel.sendv(iov, iov_count, !last || more);
+        if (n == -1) {
+            return -1;
+        }
+        total += n;
+        body_pos = end;
+        iov_count = 0;
+        if (last) {
+            break;
+        }
+
+        n = channel.send_file(extents[i].disk_fd, extents[i].disk_offset, extents[i].length);
+        if (n == -1) {
+            return -1;
+        }
+        total += n;
+        zero_copy_bytes += n;
+    }
+    return total;
+}
+
+// Logs why receiving from the client stopped: bytes_read is 0 once it
+// disconnected, -1 on error.
+static void log_receive_end(const RequestReader &reader, ssize_t bytes_read) {
+    if (reader.logger == NULL) {
+        return;
+    }
+    if (bytes_read == 0) {
+        reader.logger->log(LOG_INFO, "Client disconnected.");
+    } else {
+        reader.logger->log(LOG_ERROR, string("Error receiving data from client: ") + strerror(errno));
+    }
+}
+
+// Returns true if a complete request line is already buffered, i.e. the
+// next call to receive_client_command will not block.
+bool has_buffered_command(const RequestReader &reader) {
+    return reader.buffer.find("\r\n", reader.pos) != string::npos;
+}
+
+// Helper function to receive data until \r\n (for client commands)
+// Reads whatever the channel has available, so requests queued behind the
+// current one are picked up by the same recv().
+string receive_client_command(RequestReader &reader) {
+    size_t end_pos;
+    while ((end_pos = reader.buffer.find("\r\n", reader.pos)) == string::npos) {
+        // Drop consumed bytes before growing the buffer
+        if (reader.pos > 0) {
+            reader.buffer.erase(0, reader.pos);
+            reader.pos = 0;
+        }
+
+        if (reader.channel == NULL) { // Only what was put in the buffer
+            return "";
+        }
+        char temp_buffer[4096];
+        ssize_t bytes_read = reader.channel->recv(temp_buffer, sizeof(temp_buffer));
+        if (bytes_read <= 0) { // Connection closed or error
+            log_receive_end(reader, bytes_read);
+            return ""; // Signal end of connection or error
+        }
+        reader.buffer.append(temp_buffer, bytes_read);
+    }
+
+    // Remove the \r\n from the end of the command
+    string line = reader.buffer.substr(reader.pos, end_pos - reader.pos);
+    reader.pos = end_pos + 2;
+    return line;
+}
+
+// Reads the binary data of a request: first what is already buffered, then
+// straight from the channel in large reads.
+bool receive_client_data(RequestReader &reader, size_t length, string *data) {
+    size_t buffered = min(length, reader.buffer.length() - reader.pos);
+    if (data != NULL) {
+        data->assign(reader.buffer, reader.pos, buffered);
+    }
+    reader.pos += buffered;
+    length -= buffered;
+
+    char temp_buffer[65536];
+    while (length > 0) {
+        if (reader.channel == NULL) { // Only what was put in the buffer
+            return false;
+        }
+        ssize_t bytes_read = reader.channel->recv(temp_buffer, min(length, sizeof(temp_buffer)));
+        if (bytes_read <= 0) { // Connection closed or error
+            log_receive_end(reader, bytes_read);
+            return false;
+        }
+        if (data != NULL) {
+            data->append(temp_buffer, bytes_read);
+        }
+        length -= bytes_read;
+    }
+    return true;
+}
+
+// Parses "write <name> <offset> <length>". Returns false if it is not a
+// well-formed write request.
+static bool parse_write(const string &client_request_line, string &name, unsigned int &offset,
+                        unsigned int &length) {
+    stringstream ss(client_request_line);
+    string command_name;
+    return (ss >> command_name >> name >> offset >> length) && command_name == "write";
+}
+
+// Appends up to max_bytes more from the channel to the buffer. Returns
+// false once the client disconnected.
+static bool buffer_more(RequestReader &reader, size_t max_bytes) {
+    if (reader.channel == NULL) { // Only what was put in the buffer
+        return false;
+    }
+    char temp_buffer[65536];
+    ssize_t bytes_read = reader.channel->recv(temp_buffer, min(max_bytes, sizeof(temp_buffer)));
+    if (bytes_read <= 0) { // Connection closed or error
+        log_receive_end(reader, bytes_read);
+        return false;
+    }
+    reader.buffer.append(temp_buffer, bytes_read);
+    return true;
+}
+
+// Makes the operation lines of a batch, or the data of a write request,
+// available in the buffer. The data of an oversized write is not read:
+// rejection gets its status line instead.
+bool buffer_request_data(RequestReader &reader, const string &client_request_line,
+                         string &rejection) {
+    rejection.clear();
+    stringstream ss(client_request_line);
+    string command_name;
+    int num_ops = -1;
+    ss >> command_name >> num_ops;
+    if (command_name == "batch") {
+        size_t end = reader.pos;
+        for (int i = 0; i < num_ops; i++) {
+            size_t found;
+            while ((found = reader.buffer.find("\r\n", end)) == string::npos) {
+                if (!buffer_more(reader, string::npos)) { // as much as has arrived
+                    return false;
+                }
+            }
+            end = found + 2;
+        }
+        return true;
+    }
+
+    string name;
+    unsigned int offset;
+    unsigned int length;
+    if (!parse_write(client_request_line, name, offset, length)) {
+        return true;
+    }
+    if (length > MAX_FILE_SIZE) {
+        rejection = "508 Write exceeds maximum file size";
+        return true;
+    }
+    while (reader.buffer.length() - reader.pos < length) {
+        if (!buffer_more(reader, length - (reader.buffer.length() - reader.pos))) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Runs a single request line against the file system. Returns the status
+// line ("Status_code Status_message"); the message body is left in
+// fs.body().
+static string execute_request(FileSys &fs, const string &client_request_line) {
+    // Parse command and its arguments
+    stringstream ss(client_request_line);
+    string command_name;
+    string arg1, arg2;
+
+    ss >> command_name;
+    ss >> arg1;
+    ss >> arg2;
+
+    string fs_raw_response; // This will hold the "Status_code Status_message" from FileSys
+    fs.clear_response();
+
+    // --- Command Processing and FileSys Invocation ---
+    if (command_name == "ls" && arg1 == "-l") {
+        // "ls -l [start [count [path]]]": one page of the long listing
+        unsigned int start = 0;
+        unsigned int count = MAX_DIR_ENTRIES;
+        string path;
+        stringstream(arg2) >> start;
+        ss >> count >> path;
+        fs_raw_response = fs.ls_long(start, count, path.c_str());
+    } else if (command_name == "ls") {
+        fs_raw_response = fs.ls(arg1.c_str());
+    } else if (command_name == "mkdir") {
+        fs_raw_response = fs.mkdir(arg1.c_str());
+    } else if (command_name == "cd") {
+        fs_raw_response = fs.cd(arg1.c_str());
+    } else if (command_name == "home") {
+        fs_raw_response = fs.home();
+    } else if (command_name == "rmdir") {
+        fs_raw_response = fs.rmdir(arg1.c_str());
+    } else if (command_name == "create") {
+        fs_raw_response = fs.create(arg1.c_str());
+    } else if (command_name == "append") {
+        // Reconstruct data as it might contain spaces in the assignment's format,
+        // though the example shows no spaces in 'data' itself.
+        // If data can have spaces, it should be passed as a single argument
+        // or encoded. For now, assume arg2 is the full data, or append subsequent words.
+        string data_to_append = arg2;
+        string temp_arg;
+        while (ss >> temp_arg) { // This loop handles if data_to_append has multiple space-separated words
+            data_to_append += " " + temp_arg;
+        }
+        fs_raw_response = fs.append(arg1.c_str(), data_to_append.c_str());
+    } else if (command_name == "cat") {
+        fs_raw_response = fs.cat(arg1.c_str());
+    } else if (command_name == "head") {
+        try {
+            unsigned int n = stoul(arg2);
+            fs_raw_response = fs.head(arg1.c_str(), n);
+        } catch (const std::exception& e) {
+            fs_raw_response = "400 Bad Request";
+            fs.body() = "Invalid number for head N";
+        }
+    } else if (command_name == "read") {
+        // "read <name> <offset> <length>": file data as stored
+        unsigned int offset = 0;
+        unsigned int length = 0;
+        stringstream(arg2) >> offset;
+        if (!(ss >> length)) {
+            fs_raw_response = "400 Bad Request";
+            fs.body() = "Invalid offset or length for read";
+        } else {
+            fs_raw_response = fs.read(arg1.c_str(), offset, length);
+        }
+    } else if (command_name == "rm") {
+        if (arg1 == "-r") {
+            fs_raw_response = fs.rm_recursive(arg2.c_str());
+        } else {
+            fs_raw_response = fs.rm(arg1.c_str());
+        }
+    } else if (command_name == "stat") {
+        fs_raw_response = fs.stat(arg1.c_str());
+    } else if (command_name == "df") {
+        fs_raw_response = fs.df();
+    } else if (command_name == "stats") {
+        fs_raw_response = fs.stats();
+    } else if (command_name == "du") {
+        fs_raw_response = fs.du(arg1.c_str());
+    } else if (command_name == "find") {
+        fs_raw_response = fs.find(arg1.c_str());
+    } else if (command_name == "tree") {
+        fs_raw_response = fs.tree(arg1.c_str());
+    }
+    else {
+        fs_raw_response = "400 Bad Request";
+        fs.body() = "Unknown command";
+    }
+
+    return fs_raw_response;
+}
+
+// Returns true for commands that only change file system state and have no
+// output, which are the commands allowed inside a batch. "rm -r" is not
+// one: a whole subtree would have to be held in one transaction.
+static bool is_batchable(const string &command_name, const string &arg1) {
+    return command_name == "mkdir" || command_name == "cd" ||
+           command_name == "home" || command_name == "rmdir" ||
+           command_name == "create" || command_name == "append" ||
+           (command_name == "rm" && arg1 != "-r");
+}
+
+// Executes a batch of num_ops request lines, which buffer_request_data
+// read after the "batch <n>" line, as one transaction. Returns the status line and leaves
+// the body in fs.body(). If any operation fails, the changes made by the
+// earlier ones are discarded. The body has one
+// "<request>: <status>" line per operation; operations after the failing
+// one are reported as skipped.
+static string execute_batch(FileSys &fs, RequestReader &reader, int num_ops, bool &disconnected) {
+    stringstream body;
+    bool failed = false;
+
+    fs.begin_transaction();
+    for (int i = 0; i < num_ops; i++) {
+        if (!has_buffered_command(reader)) { // Client disconnected in the middle of a batch
+            disconnected = true;
+            fs.abort_transaction();
+            return "";
+        }
+        string op_line = receive_client_command(reader);
+
+        if (failed) {
+            body << op_line << ": skipped\n";
+            continue;
+        }
+
+        string op_name;
+        string op_arg1;
+        stringstream(op_line) >> op_name >> op_arg1;
+        string op_status;
+        if (is_batchable(op_name, op_arg1)) {
+            op_status = execute_request(fs, op_line);
+        } else {
+            op_status = "400 Bad Request";
+        }
+        body << op_line << ": " << op_status << "\n";
+
+        if (op_status.compare(0, 3, "200") != 0) {
+            failed = true;
+        }
+    }
+
+    fs.body() = body.str();
+    if (failed) {
+        fs.abort_transaction();
+        return "509 Batch failed, no changes made";
+    }
+    fs.commit_transaction();
+    return "200 OK";
+}
+
+// Executes "write <name> <offset> <length>", whose line is followed by
+// length bytes of binary data. Data that cannot fit in a file is read and
+// dropped, so the next request starts in the right place (the server
+// rejects such writes in buffer_request_data instead).
+static string execute_write(FileSys &fs, RequestReader &reader, const string &client_request_line,
+                            bool &disconnected) {
+    string name;
+    unsigned int offset = 0;
+    unsigned int length = 0;
+    fs.clear_response();
+    if (!parse_write(client_request_line, name, offset, length)) {
+        fs.body() = "Invalid name, offset or length for write";
+        return "400 Bad Request";
+    }
+
+    if (length > MAX_FILE_SIZE) {
+        if (!receive_client_data(reader, length, NULL)) {
+            disconnected = true;
+            return "";
+        }
+        return "508 Write exceeds maximum file size";
+    }
+    string data;
+    if (!receive_client_data(reader, length, &data)) {
+        disconnected = true;
+        return "";
+    }
+    return fs.write(name.c_str(), offset, data.data(), length);
+}
+
+// A "batch <n>" line is followed by its n operations, and a "write" line by
+// its data, which are read here; every other line is a single request.
+string handle_request(FileSys &fs, RequestReader &reader,
+                      const string &client_request_line, bool &disconnected) {
+    // Parse command and its arguments
+    stringstream ss(client_request_line);
+    string command_name;
+    int num_ops = -1;
+    ss >> command_name >> num_ops;
+
+    fs.clear_changes();
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    string status;
+    if (command_name == "write") {
+        status = execute_write(fs, reader, client_request_line, disconnected);
+    } else if (command_name != "batch") {
+        status = execute_request(fs, client_request_line);
+    } else if (num_ops < 0) {
+        fs.clear_response();
+        fs.body() = "Invalid number of batch operations";
+        status = "400 Bad Request";
+    } else {
+        status = execute_batch(fs, reader, num_ops, disconnected);
+    }
+    if (!disconnected) {
+        long long ns = chrono::duration_cast<chrono::nanoseconds>(
+            chrono::steady_clock::now() - start).count();
+        fs.metrics().record_request(command_name, ns, status.compare(0, 1, "2") == 0);
+    }
+    return status;
+}
+
+// The FileSys methods return "Status_code Status_message" and leave the
+// body in fs. The final message format is:
+// "Status_code Status_message\r\nLength:size_in_bytes\r\n\r\n<message_body>"
+// The header is built separately and goes out together with the body, so
+// the body is never copied into the response.
+string response_header(const string &status, size_t body_length, const string &extra) {
+    string header = status + "\r\n"; // First header line
+    header += "Length:" + to_string(body_length) + "\r\n"; // Second header line
+    header += extra; // Optional header lines, e.g. "Size:..." or "Lease:..."
+    header += "\r\n"; // Blank line
+    return header;
+}
@@ -0,0 +1,69 @@
+// CPSC 3500: Dispatch
+// Reads client requests, runs them against the file system and sends the
+// responses. Shared by the server and the shell's embedded (local:) mode.
+
+#ifndef DISPATCH_H
+#define DISPATCH_H
+
+#include <string>
+#include "FileSys.h"
+#include "Channel.h"
+#include "Logger.h"
+
+// Per-connection receive buffer. Clients may pipeline several requests
+// without waiting for responses, so the channel is drained in large reads
+// and complete lines are handed out one at a time from the buffer.
+struct RequestReader {
+    Channel *channel;    // source of requests, NULL if only buffer is read
+    std::string buffer;  // bytes received but not yet consumed
+    size_t pos;          // start of the next unconsumed request in buffer
+    Logger *logger;      // where a disconnection or receive error is logged, NULL for nowhere
+
+    RequestReader(Channel *c) : channel(c), pos(0), logger(NULL) {}
+};
+
+// Returns true if a complete request line is already buffered, i.e. the
+// next call to receive_client_command will not block.
+bool has_buffered_command(const RequestReader &reader);
+
+// Returns the next request line without its \r\n, or "" once the client
+// disconnected.
+std::string receive_client_command(RequestReader &reader);
+
+// Reads the length bytes of binary data that follow a request line into
+// data, or drops them if data is NULL. Returns false once the client
+// disconnected.
+bool receive_client_data(RequestReader &reader, size_t length, std::string *data);
+
+// Reads the operation lines that follow a batch request line, or the data
+// that follows a write request line, into reader's buffer, so that
+// handle_request will not wait for the client (e.g. while holding a lock).
+// Does nothing for other requests. A write too large for any file is not
+// read: rejection is set to its status line, and the caller should answer
+// it and close the connection. Returns false once the client disconnected.
+bool buffer_request_data(RequestReader &reader, const std::string &client_request_line,
+                         std::string &rejection);
+
+// Runs request line client_request_line, reading the rest of a batch or
+// the data of a write from reader; a batch's lines must already be
+// buffered (see buffer_request_data). Returns the status line ("Status_code Status_message") and leaves
+// the body, the path it read and the paths it changed in fs. Sets
+// disconnected if the client left in the middle of a batch or write.
+// Counts the request and its run time in fs.metrics().
+std::string handle_request(FileSys &fs, RequestReader &reader,
+                           const std::string &client_request_line, bool &disconnected);
+
+// Returns the response header for a status line and body length:
+// "Status_code Status_message\r\nLength:size_in_bytes\r\n\r\n"
+// extra holds further header lines, each ending in \r\n, placed after
+// the Length line.
+std::string response_header(const std::string &status, size_t body_length,
+                            const std::string &extra = "");
+
+// Sends header and the body left in fs. Returns -1 on failure, total bytes
+// sent on success; body bytes sent without a copy are added to
+// zero_copy_bytes.
+ssize_t send_response(Channel &channel, const std::string &header, FileSys &fs, bool more,
+                      size_t &zero_copy_bytes);
+
+#endif
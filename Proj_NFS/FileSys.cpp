@@ -7,18 +7,106 @@
 #include <sstream>      // For std::stringstream
 #include <algorithm>    // For std::min
 #include <string>       // For std::string
+#include <vector>       // For std::vector
+#include <map>          // For std::map
+#include <fnmatch.h>    // For fnmatch (find patterns)
 
 using namespace std;
 
 #include "FileSys.h"
 #include "BasicFileSys.h" // Included via FileSys.h now
 #include "Blocks.h"       // Included via FileSys.h now
+#include "Trace.h"
+
+// Shortest run of consecutive data blocks worth sending with sendfile;
+// shorter runs are cheaper to copy
+static const int ZERO_COPY_MIN_BLOCKS = 4;
+
+// Returns the absolute path of the directory holding path.
+static string parent_path(const string &path)
+{
+  size_t slash = path.rfind('/');
+  return slash == 0 ? "/" : path.substr(0, slash);
+}
 
 // Constructor
-FileSys::FileSys() : bfs(), curr_dir(1), fs_sock(-1) {
+FileSys::FileSys() : volume(new Volume()), owns_volume(true), bfs(volume->bfs),
+                     path_cache(volume->path_cache), curr_dir(1), saved_dir(1),
+                     curr_path("/"), saved_path("/"), fs_sock(-1), zero_copy(false) {
     // BasicFileSys will be mounted/unmounted by server.cpp
 }
 
+// Constructor for a session on a shared volume
+FileSys::FileSys(Volume &shared) : volume(&shared), owns_volume(false), bfs(shared.bfs),
+                                   path_cache(shared.path_cache), curr_dir(1), saved_dir(1),
+                                   curr_path("/"), saved_path("/"), fs_sock(-1),
+                                   zero_copy(false) {
+}
+
+FileSys::~FileSys() {
+    if (owns_volume) {
+        delete volume;
+    }
+}
+
+// Helper function that reads n bytes of a data file, starting at offset,
+// into the response body. Each run of consecutive data blocks is read with
+// one batched read directly into the body's storage, so file data is
+// copied once on its way from the disk to the socket. With zero copy
+// enabled, runs of at least ZERO_COPY_MIN_BLOCKS blocks stored together
+// are not read at all; they become extents that the server sends from the
+// disk file.
+void FileSys::read_file_data(const struct inode_t &inode, unsigned int offset, unsigned int n)
+{
+  TraceScope span("read file data");
+  int num_blocks = (offset + n + BLOCK_SIZE - 1) / BLOCK_SIZE;
+  while (num_blocks > 0 && inode.blocks[num_blocks - 1] == 0) { // Defensive check
+    num_blocks--;
+  }
+  unsigned int end = min(offset + n, (unsigned int)(num_blocks * BLOCK_SIZE));
+
+  out_body.clear();
+  out_extents.clear();
+  int run_start = offset / BLOCK_SIZE;
+  while (offset < end && run_start < num_blocks) {
+    int run_end = run_start + 1;
+    while (run_end < num_blocks &&
+           inode.blocks[run_end] == inode.blocks[run_end - 1] + 1) {
+      run_end++;
+    }
+    // an extent covers blocks stored together, which on a striped disk
+    // ends with the stripe unit
+    DiskExtent extent;
+    bool mapped = false;
+    if (zero_copy && run_end - run_start >= ZERO_COPY_MIN_BLOCKS) {
+      int stored_together = bfs.map_block(inode.blocks[run_start], extent.disk_fd, extent.disk_offset);
+      if (stored_together > 0) {
+        run_end = min(run_end, run_start + stored_together);
+        mapped = run_end - run_start >= ZERO_COPY_MIN_BLOCKS;
+      }
+    }
+    // bytes [from, to) of the file lie in this run
+    size_t from = max(offset, (unsigned int)(run_start * BLOCK_SIZE));
+    size_t to = min(end, (unsigned int)(run_end * BLOCK_SIZE));
+    size_t skip = from - run_start * BLOCK_SIZE;
+
+    if (mapped) {
+      extent.body_offset = out_body.size();
+      extent.disk_offset += skip;
+      extent.length = to - from;
+      out_extents.push_back(extent);
+    } else {
+      size_t at = out_body.size();
+      out_body.resize(at + (run_end - run_start) * BLOCK_SIZE);
+      bfs.read_blocks(&inode.blocks[run_start], run_end - run_start,
+                      (datablock_t *) &out_body[at]);
+      out_body.erase(at, skip);
+      out_body.resize(at + to - from);
+    }
+    run_start = run_end;
+  }
+}
+
 // Helper function to check if a block is a directory
 // Reads the block and checks its magic number.
 bool FileSys::is_directory(short block_num) {
@@ -35,16 +123,77 @@ bool FileSys::is_directory(short block_num) {
     return magic_num == DIR_MAGIC_NUM;
 }
 
+// message body of the last command's response
+string &FileSys::body() {
+  return out_body;
+}
+
+// parts of the body left on the disk; empty unless zero copy is enabled
+const vector<FileSys::DiskExtent> &FileSys::body_extents() {
+  return out_extents;
+}
+
+// total body length: body() plus all extents
+size_t FileSys::body_length() {
+  size_t length = out_body.length();
+  for (size_t i = 0; i < out_extents.size(); i++) {
+    length += out_extents[i].length;
+  }
+  return length;
+}
+
+// extra response header lines of the last command
+const string &FileSys::headers() {
+  return out_headers;
+}
+
+// empties body(), body_extents() and headers() before the next command
+void FileSys::clear_response() {
+  out_body.clear();
+  out_extents.clear();
+  out_headers.clear();
+  out_read_path.clear();
+}
+
+// lets cat and head leave contiguous file data on the disk, for
+// connections that can transfer it with sendfile
+void FileSys::set_zero_copy(bool enabled) {
+  zero_copy = enabled;
+}
+
+// absolute path whose listing, stat or contents the last command returned
+const string &FileSys::read_path() {
+  return out_read_path;
+}
+
+// absolute paths changed since clear_changes()
+const vector<string> &FileSys::changed_paths() {
+  return out_changed;
+}
+
+// empties changed_paths()
+void FileSys::clear_changes() {
+  out_changed.clear();
+}
+
 // mounts the file system
-void FileSys::mount(int sock) {
-  bfs.mount();
+void FileSys::mount(int sock, const char *disk_name) {
+  if (owns_volume) {
+    bfs.mount(disk_name);
+    path_cache.clear();
+  }
+  volume->sessions.push_back(this);
   curr_dir = 1; //by default current directory is home directory, in disk block #1
+  curr_path = "/";
   fs_sock = sock; //use this socket to receive file system operations from the client and send back response messages
 }
 
 // unmounts the file system
 void FileSys::unmount() {
-  bfs.unmount();
+  volume->sessions.erase(std::find(volume->sessions.begin(), volume->sessions.end(), this));
+  if (owns_volume) {
+    bfs.unmount();
+  }
   if (fs_sock != -1) { // Only close if it's a valid socket
       close(fs_sock);
       fs_sock = -1;
@@ -52,16 +201,30 @@ void FileSys::unmount() {
 }
 
 // make a directory
-string FileSys::mkdir(const char *name)
+string FileSys::mkdir(const char *path)
 {
+  // Resolve the directory that holds the last path component
+  ResolvedPath target;
+  string status = resolve_parent(path, target);
+  if (!status.empty()) {
+    return status;
+  }
+  const char *name = target.leaf.c_str();
+  short dir_num = target.dir_block;
+
+  // The root (or any path naming an existing directory) already exists
+  if (target.leaf.empty()) {
+    return "502 File exists";
+  }
+
   // Check if name is too long
   if (strlen(name) > MAX_FNAME_SIZE) {
     return "504 File name is too long";
   }
 
-  // Read current directory block
+  // Read the directory block
   struct dirblock_t dir_block;
-  bfs.read_block(curr_dir, (void *) &dir_block);
+  bfs.read_block(dir_num, (void *) &dir_block);
 
   // Check if name already exists
   for (int i = 0; i < dir_block.num_entries; i++) {
@@ -85,6 +248,10 @@ string FileSys::mkdir(const char *name)
   struct dirblock_t new_dir;
   new_dir.magic = DIR_MAGIC_NUM;
   new_dir.num_entries = 0;
+  new_dir.tree_bytes = 0;
+  new_dir.tree_blocks = 1;
+  new_dir.parent = dir_num;
+  new_dir.reserved = 0;
   for (int i = 0; i < MAX_DIR_ENTRIES; i++) {
     new_dir.dir_entries[i].block_num = 0; // Unused entries indicated by block_num of 0
   }
@@ -94,16 +261,29 @@ string FileSys::mkdir(const char *name)
   strcpy(dir_block.dir_entries[dir_block.num_entries].name, name); // Copy name (null-terminated)
   dir_block.dir_entries[dir_block.num_entries].block_num = new_block_num; // Store new directory's block number
   dir_block.num_entries++; // Increment entry count
-  bfs.write_block(curr_dir, (void *) &dir_block); // Write updated current directory back to disk
+  bfs.write_block(dir_num, (void *) &dir_block); // Write updated directory back to disk
+  update_tree_totals(dir_num, 0, 1); // Count the new directory block
+  note_change(parent_path(target.path));
+  note_change(target.path);
 
   return "200 OK"; // Success message
 }
 
-// list the contents of current directory
-string FileSys::ls()
+// list the contents of a directory (the current directory by default)
+string FileSys::ls(const char *path)
 {
+  ResolvedPath target;
+  short dir_num = 0;
+  string status = resolve(path, target, dir_num);
+  if (!status.empty()) {
+    return status;
+  }
+  if (!is_directory(dir_num)) {
+    return "500 File is not a directory";
+  }
+
   struct dirblock_t dir_block;
-  bfs.read_block(curr_dir, (void *)&dir_block); // Read current directory block
+  bfs.read_block(dir_num, (void *)&dir_block); // Read the directory block
 
   stringstream ss; // Use stringstream to build the output string
 
@@ -123,30 +303,85 @@ string FileSys::ls()
     }
   }
   // The assignment example for ls success just shows the content, no "200 OK"
-  // So, return "200 OK\n" followed by the content. Shell.cpp will handle printing.
-  return "200 OK\n" + ss.str();
+  // So, the content goes in the response body. Shell.cpp will handle printing.
+  out_body = ss.str();
+  out_read_path = target.path;
+  return "200 OK";
 }
 
-// switch to a directory
-string FileSys::cd(const char *name)
+// list up to count entries of a directory (the current directory by
+// default), starting at entry start. The directory is read once and the inodes of all listed entries
+// are fetched with one batched read. Each row is
+// "<name> <type> <size> <blocks>", where a directory's size and blocks are
+// its tree totals; the status is "206" if more entries remain after this
+// page.
+string FileSys::ls_long(unsigned int start, unsigned int count, const char *path)
 {
-  // Read current directory block
+  ResolvedPath target;
+  short dir_num = 0;
+  string status = resolve(path, target, dir_num);
+  if (!status.empty()) {
+    return status;
+  }
+  if (!is_directory(dir_num)) {
+    return "500 File is not a directory";
+  }
+
   struct dirblock_t dir_block;
-  bfs.read_block(curr_dir, (void *) &dir_block);
+  bfs.read_block(dir_num, (void *)&dir_block); // Read the directory block
 
-  // Find the directory entry
-  short target_block = 0;
-  bool found = false;
-  for (int i = 0; i < dir_block.num_entries; i++) {
-    if (strcmp(dir_block.dir_entries[i].name, name) == 0) {
-      found = true;
-      target_block = dir_block.dir_entries[i].block_num;
-      break;
+  unsigned int end = dir_block.num_entries;
+  if (start > end) {
+    start = end;
+  }
+  if (count < end - start) {
+    end = start + count;
+  }
+
+  vector<short> block_nums;
+  for (unsigned int i = start; i < end; i++) {
+    block_nums.push_back(dir_block.dir_entries[i].block_num);
+  }
+  vector<datablock_t> blocks(block_nums.size());
+  bfs.read_blocks(block_nums.data(), block_nums.size(), blocks.data());
+
+  stringstream ss;
+  for (size_t i = 0; i < blocks.size(); i++) {
+    struct inode_t *inode = (struct inode_t *) &blocks[i];
+    string name = dir_block.dir_entries[start + i].name;
+    if (inode->magic == DIR_MAGIC_NUM) {
+      struct dirblock_t *dir = (struct dirblock_t *) &blocks[i];
+      ss << name << "/ dir " << dir->tree_bytes << " " << dir->tree_blocks;
+    } else {
+      int block_count = 1; // the inode itself
+      for (int j = 0; j < MAX_DATA_BLOCKS; j++) {
+        if (inode->blocks[j] != 0) {
+          block_count++;
+        }
+      }
+      ss << name << " file " << inode->size << " " << block_count;
+    }
+    if (i + 1 < blocks.size()) {
+      ss << "\n";
     }
   }
 
-  if (!found) {
-    return "503 File does not exist";
+  out_body = ss.str();
+  if (end < dir_block.num_entries) {
+    return "206 More entries";
+  }
+  return "200 OK";
+}
+
+// switch to a directory
+string FileSys::cd(const char *path)
+{
+  // Find the target
+  ResolvedPath target;
+  short target_block = 0;
+  string status = resolve(path, target, target_block);
+  if (!status.empty()) {
+    return status;
   }
 
   // Verify that target is a directory
@@ -156,21 +391,38 @@ string FileSys::cd(const char *name)
 
   // Change to the new directory
   curr_dir = target_block; // Update current directory tracker
+  curr_path = target.path;
+  path_cache[curr_path] = curr_dir;
   return "200 OK"; // Success message
 }
 
 // switch to home directory
 string FileSys::home() {
   curr_dir = 1; // Home directory is always block 1
+  curr_path = "/";
   return "200 OK"; // Success message
 }
 
 // remove a directory
-string FileSys::rmdir(const char *name)
+string FileSys::rmdir(const char *path)
 {
-  // Read current directory block
+  // Resolve the directory that holds the last path component
+  ResolvedPath target;
+  string status = resolve_parent(path, target);
+  if (!status.empty()) {
+    return status;
+  }
+  const char *name = target.leaf.c_str();
+  short dir_num = target.dir_block;
+
+  // Refuse to remove the current directory or one of its ancestors
+  if (in_use(target.path)) {
+    return "510 Directory is in use";
+  }
+
+  // Read the directory block
   struct dirblock_t dir_block;
-  bfs.read_block(curr_dir, (void *)&dir_block);
+  bfs.read_block(dir_num, (void *)&dir_block);
 
   // Find the directory entry
   int entry_index = -1;
@@ -207,26 +459,43 @@ string FileSys::rmdir(const char *name)
   dir_block.dir_entries[dir_block.num_entries - 1].block_num = 0;
   memset(dir_block.dir_entries[dir_block.num_entries - 1].name, 0, MAX_FNAME_SIZE + 1);
   dir_block.num_entries--; // Decrement entry count
-  bfs.write_block(curr_dir, (void *)&dir_block); // Write updated current directory
+  bfs.write_block(dir_num, (void *)&dir_block); // Write updated directory
+  update_tree_totals(dir_num, 0, -1);
 
   // Free the directory block
   bfs.reclaim_block(dir_block_num);
+  forget_paths(target.path);
+  note_change(parent_path(target.path));
+  note_change(target.path, true);
 
   return "200 OK"; // Success message
 }
 
 
 // create an empty data file
-string FileSys::create(const char *name)
+string FileSys::create(const char *path)
 {
+  // Resolve the directory that holds the last path component
+  ResolvedPath target;
+  string status = resolve_parent(path, target);
+  if (!status.empty()) {
+    return status;
+  }
+  const char *name = target.leaf.c_str();
+  short dir_num = target.dir_block;
+
+  if (target.leaf.empty()) {
+    return "502 File exists";
+  }
+
   // Check if name is too long
   if (strlen(name) > MAX_FNAME_SIZE) {
     return "504 File name is too long";
   }
 
-  // Read current directory block
+  // Read the directory block
   struct dirblock_t dir_block;
-  bfs.read_block(curr_dir, (void *)&dir_block);
+  bfs.read_block(dir_num, (void *)&dir_block);
 
   // Check if name already exists
   for (int i = 0; i < dir_block.num_entries; i++) {
@@ -259,17 +528,29 @@ string FileSys::create(const char *name)
   strcpy(dir_block.dir_entries[dir_block.num_entries].name, name); // Copy name (null-terminated)
   dir_block.dir_entries[dir_block.num_entries].block_num = inode_block; // Store new file's inode block number
   dir_block.num_entries++; // Increment entry count
-  bfs.write_block(curr_dir, (void *)&dir_block); // Write updated current directory
+  bfs.write_block(dir_num, (void *)&dir_block); // Write updated directory
+  update_tree_totals(dir_num, 0, 1); // Count the new inode
+  note_change(parent_path(target.path));
+  note_change(target.path);
 
   return "200 OK"; // Success message
 }
 
 // append data to a data file
-string FileSys::append(const char *name, const char *data)
+string FileSys::append(const char *path, const char *data)
 {
-  // Read current directory block
+  // Resolve the directory that holds the last path component
+  ResolvedPath target;
+  string status = resolve_parent(path, target);
+  if (!status.empty()) {
+    return status;
+  }
+  const char *name = target.leaf.c_str();
+  short dir_num = target.dir_block;
+
+  // Read the directory block
   struct dirblock_t dir_block;
-  bfs.read_block(curr_dir, (void *)&dir_block);
+  bfs.read_block(dir_num, (void *)&dir_block);
 
   // Find the file entry
   int entry_index = -1;
@@ -305,6 +586,7 @@ string FileSys::append(const char *name, const char *data)
 
   int bytes_to_write_total = data_len;
   int current_append_offset = 0; // Tracks bytes from 'data' string being appended
+  int new_blocks = 0; // Data blocks allocated by this append
 
   // Loop until all data is appended
   while (bytes_to_write_total > 0) {
@@ -322,11 +604,18 @@ string FileSys::append(const char *name, const char *data)
 
       // Check if we need to allocate a new data block or use an existing one
       if (inode.blocks[last_block_index] == 0) { // New data block needed
-          current_data_block_num = bfs.get_free_block();
+          // next to the file's last block, or its inode, for locality
+          current_data_block_num = bfs.get_free_block(
+              last_block_index > 0 ? inode.blocks[last_block_index - 1] : inode_block_num);
           if (current_data_block_num == 0) { // Disk is full
+              // keep what was written so far consistent with the totals
+              bfs.write_block(inode_block_num, (void *)&inode);
+              update_tree_totals(dir_num, current_append_offset, new_blocks);
+              note_change(target.path);
               return "505 Disk is full";
           }
           inode.blocks[last_block_index] = current_data_block_num; // Update inode's block pointer
+          new_blocks++;
       } else { // Use existing block
           current_data_block_num = inode.blocks[last_block_index];
       }
@@ -350,16 +639,27 @@ string FileSys::append(const char *name, const char *data)
 
   // Write the updated inode back to disk after all data blocks are handled
   bfs.write_block(inode_block_num, (void *)&inode);
+  update_tree_totals(dir_num, data_len, new_blocks);
+  note_change(target.path);
 
   return "200 OK"; // Success message
 }
 
 // display the contents of a data file
-string FileSys::cat(const char *name)
+string FileSys::cat(const char *path)
 {
-  // Read current directory block
+  // Resolve the directory that holds the last path component
+  ResolvedPath target;
+  string status = resolve_parent(path, target);
+  if (!status.empty()) {
+    return status;
+  }
+  const char *name = target.leaf.c_str();
+  short dir_num = target.dir_block;
+
+  // Read the directory block
   struct dirblock_t dir_block;
-  bfs.read_block(curr_dir, (void *)&dir_block);
+  bfs.read_block(dir_num, (void *)&dir_block);
 
   // Find the file entry
   int entry_index = -1;
@@ -383,35 +683,28 @@ string FileSys::cat(const char *name)
     return "501 File is a directory";
   }
 
-  stringstream ss; // Use stringstream to build the output string
-  int remaining_bytes = inode.size; // Total bytes in file
-  int current_block_idx = 0;
-  struct datablock_t data_block;
-
-  while (remaining_bytes > 0 && current_block_idx < MAX_DATA_BLOCKS) {
-    if (inode.blocks[current_block_idx] == 0) { // Should not happen if size is correct, but defensive
-      break;
-    }
-
-    bfs.read_block(inode.blocks[current_block_idx], (void *)&data_block);
-    int bytes_to_read_in_block = min(remaining_bytes, BLOCK_SIZE);
-
-    // Append data to stringstream (copy character by character or using string constructor)
-    ss.write(data_block.data, bytes_to_read_in_block);
-
-    remaining_bytes -= bytes_to_read_in_block;
-    current_block_idx++;
-  }
-  // Print a newline when completed.
-  return "200 OK\n" + ss.str() + "\n"; // Combine status and content, add trailing newline
+  // Read the file straight into the response body and add a newline
+  read_file_data(inode, 0, inode.size);
+  out_body += '\n';
+  out_read_path = target.path;
+  return "200 OK";
 }
 
 // display the first N bytes of the file
-string FileSys::head(const char *name, unsigned int n)
+string FileSys::head(const char *path, unsigned int n)
 {
-  // Read current directory block
+  // Resolve the directory that holds the last path component
+  ResolvedPath target;
+  string status = resolve_parent(path, target);
+  if (!status.empty()) {
+    return status;
+  }
+  const char *name = target.leaf.c_str();
+  short dir_num = target.dir_block;
+
+  // Read the directory block
   struct dirblock_t dir_block;
-  bfs.read_block(curr_dir, (void *)&dir_block);
+  bfs.read_block(dir_num, (void *)&dir_block);
 
   // Find the file entry
   int entry_index = -1;
@@ -435,37 +728,141 @@ string FileSys::head(const char *name, unsigned int n)
     return "501 File is a directory";
   }
 
-  stringstream ss; // Use stringstream to build the output string
   // Display the first N bytes of the file. If N >= file size, print the whole file.
-  unsigned int bytes_to_read_total = min(n, inode.size);
-  unsigned int remaining_bytes = bytes_to_read_total;
-  int current_block_idx = 0;
-  struct datablock_t data_block;
+  read_file_data(inode, 0, min(n, inode.size));
+  out_body += '\n';
+  out_read_path = target.path;
+  return "200 OK";
+}
 
-  while (remaining_bytes > 0 && current_block_idx < MAX_DATA_BLOCKS) {
-    if (inode.blocks[current_block_idx] == 0) { // Defensive check
-      break;
-    }
+// return up to n bytes of a data file starting at offset
+string FileSys::read(const char *path, unsigned int offset, unsigned int n)
+{
+  ResolvedPath target;
+  short inode_block_num;
+  struct inode_t inode;
+  string status = resolve_file(path, target, inode_block_num, inode);
+  if (!status.empty()) {
+    return status;
+  }
 
-    bfs.read_block(inode.blocks[current_block_idx], (void *)&data_block);
-    unsigned int bytes_to_read_in_block = min(remaining_bytes, (unsigned int)BLOCK_SIZE);
+  // The file data goes into the body as stored, with no newline, so the
+  // reader can put the pieces of a file back together
+  if (offset < inode.size) {
+    read_file_data(inode, offset, min(n, inode.size - offset));
+  }
+  out_headers = "Size:" + to_string(inode.size) + "\r\n";
+  return "200 OK";
+}
 
-    // Append data to stringstream
-    ss.write(data_block.data, bytes_to_read_in_block);
+// write length bytes of data into a data file at offset
+string FileSys::write(const char *path, unsigned int offset, const char *data,
+                      unsigned int length)
+{
+  ResolvedPath target;
+  short inode_block_num;
+  struct inode_t inode;
+  string status = resolve_file(path, target, inode_block_num, inode);
+  if (!status.empty()) {
+    return status;
+  }
 
-    remaining_bytes -= bytes_to_read_in_block;
-    current_block_idx++;
+  if (offset > MAX_FILE_SIZE || length > MAX_FILE_SIZE - offset) {
+    return "508 Write exceeds maximum file size";
+  }
+  if (length == 0) {
+    return "200 OK";
   }
-  // Print a newline when completed.
-  return "200 OK\n" + ss.str() + "\n"; // Combine status and content, add trailing newline
+
+  // Blocks from the one holding the old end of file (or offset, if it
+  // comes first) to the one holding the new end change: the gap between
+  // the old end and offset becomes zeros, then the data is copied in.
+  // All of them are written with one batched write.
+  unsigned int old_size = inode.size;
+  unsigned int end = offset + length;
+  int first = min(old_size, offset) / BLOCK_SIZE;
+  int last = (end - 1) / BLOCK_SIZE;
+  vector<short> block_nums;
+  vector<datablock_t> blocks(last - first + 1);
+  int new_blocks = 0;
+  int fresh_end = first; // blocks before this one were just allocated
+  string result = "200 OK";
+  for (int i = first; i <= last; i++) {
+    datablock_t &block = blocks[i - first];
+    unsigned int block_start = i * BLOCK_SIZE;
+    if (inode.blocks[i] == 0) {
+      // the run of blocks the file lacks from here, in one contiguous
+      // extent if there is one, else a block at a time; next to the
+      // file's previous block, or its inode, for locality
+      short near = i > 0 && inode.blocks[i - 1] != 0 ? inode.blocks[i - 1] : inode_block_num;
+      int run = 1;
+      while (i + run <= last && inode.blocks[i + run] == 0) {
+        run++;
+      }
+      short block_num = run > 1 ? bfs.get_free_blocks(run, near) : 0;
+      if (block_num == 0) {
+        run = 1;
+        block_num = bfs.get_free_block(near);
+      }
+      if (block_num == 0) { // Disk is full; keep the blocks written so far
+        end = max(offset, block_start);
+        result = "505 Disk is full";
+        break;
+      }
+      for (int j = 0; j < run; j++) {
+        inode.blocks[i + j] = block_num + j;
+      }
+      new_blocks += run;
+      fresh_end = i + run;
+    }
+    if (i < fresh_end) {
+      memset(block.data, 0, BLOCK_SIZE);
+    } else {
+      bfs.read_block(inode.blocks[i], (void *) &block);
+    }
+
+    // zeros between the old end of file and offset
+    unsigned int zero_from = max(old_size, block_start);
+    unsigned int zero_to = min(offset, block_start + BLOCK_SIZE);
+    if (zero_from < zero_to) {
+      memset(block.data + zero_from - block_start, 0, zero_to - zero_from);
+    }
+
+    // the part of data that falls in this block
+    unsigned int copy_from = max(offset, block_start);
+    unsigned int copy_to = min(end, block_start + BLOCK_SIZE);
+    if (copy_from < copy_to) {
+      memcpy(block.data + copy_from - block_start, data + copy_from - offset,
+             copy_to - copy_from);
+    }
+    block_nums.push_back(inode.blocks[i]);
+  }
+  if (!block_nums.empty()) {
+    bfs.write_blocks(block_nums.data(), block_nums.size(), blocks.data());
+  }
+
+  inode.size = max(old_size, min(end, (unsigned int)((first + block_nums.size()) * BLOCK_SIZE)));
+  bfs.write_block(inode_block_num, (void *) &inode);
+  update_tree_totals(target.dir_block, inode.size - old_size, new_blocks);
+  note_change(target.path);
+  return result;
 }
 
 // delete a data file
-string FileSys::rm(const char *name)
+string FileSys::rm(const char *path)
 {
-  // Read current directory block
+  // Resolve the directory that holds the last path component
+  ResolvedPath target;
+  string status = resolve_parent(path, target);
+  if (!status.empty()) {
+    return status;
+  }
+  const char *name = target.leaf.c_str();
+  short dir_num = target.dir_block;
+
+  // Read the directory block
   struct dirblock_t dir_block;
-  bfs.read_block(curr_dir, (void *)&dir_block);
+  bfs.read_block(dir_num, (void *)&dir_block);
 
   // Find the file entry
   int entry_index = -1;
@@ -490,10 +887,12 @@ string FileSys::rm(const char *name)
   }
 
   // Free all data blocks used by the file
+  int freed_blocks = 1; // the inode, freed below
   for (int i = 0; i < MAX_DATA_BLOCKS; i++) {
     if (inode.blocks[i] != 0) {
       bfs.reclaim_block(inode.blocks[i]);
       inode.blocks[i] = 0; // Clear pointer in inode (though inode will be reclaimed too)
+      freed_blocks++;
     }
   }
 
@@ -508,17 +907,29 @@ string FileSys::rm(const char *name)
   dir_block.dir_entries[dir_block.num_entries - 1].block_num = 0;
   memset(dir_block.dir_entries[dir_block.num_entries - 1].name, 0, MAX_FNAME_SIZE + 1);
   dir_block.num_entries--; // Decrement entry count
-  bfs.write_block(curr_dir, (void *)&dir_block); // Write updated current directory
+  bfs.write_block(dir_num, (void *)&dir_block); // Write updated directory
+  update_tree_totals(dir_num, -(int)inode.size, -freed_blocks);
+  note_change(parent_path(target.path));
+  note_change(target.path);
 
   return "200 OK"; // Success message
 }
 
 // display stats about file or directory
-string FileSys::stat(const char *name)
+string FileSys::stat(const char *path)
 {
-  // Read current directory block
+  // Resolve the directory that holds the last path component
+  ResolvedPath target;
+  string status = resolve_parent(path, target);
+  if (!status.empty()) {
+    return status;
+  }
+  const char *name = target.leaf.c_str();
+  short dir_num = target.dir_block;
+
+  // Read the directory block
   struct dirblock_t dir_block;
-  bfs.read_block(curr_dir, (void *)&dir_block);
+  bfs.read_block(dir_num, (void *)&dir_block);
 
   // Find the entry
   int entry_index = -1;
@@ -571,5 +982,541 @@ string FileSys::stat(const char *name)
     // Should not happen if all blocks are properly initialized
     return "500 Internal error: Invalid block type encountered";
   }
-  return "200 OK\n" + ss.str(); // Combine status and content
-}
\ No newline at end of file
+  out_body = ss.str();
+  out_read_path = target.path;
+  return "200 OK";
+}
+
+// Adds bytes_delta and blocks_delta to the tree totals of dir_block and of
+// every directory above it, up to the root.
+void FileSys::update_tree_totals(short dir_block, int bytes_delta, int blocks_delta)
+{
+  if (bytes_delta == 0 && blocks_delta == 0) return;
+  TraceScope span("update tree totals", dir_block, 1);
+
+  while (true) {
+    struct dirblock_t dir;
+    bfs.read_block(dir_block, (void *) &dir);
+    dir.tree_bytes += bytes_delta;
+    dir.tree_blocks += blocks_delta;
+    bfs.write_block(dir_block, (void *) &dir);
+
+    if (dir_block == 1) break; // the root has no parent
+    dir_block = dir.parent;
+  }
+}
+
+// Splits path (absolute, or relative to curr_path) into the components
+// of its canonical absolute path. "." and ".." are resolved textually;
+// ".." at the root stays at the root.
+static vector<string> split_path(const string &curr_path, const char *path)
+{
+  vector<string> parts;
+  string full = (path[0] == '/') ? string(path) : curr_path + "/" + path;
+  stringstream ss(full);
+  string part;
+  while (getline(ss, part, '/')) {
+    if (part.empty() || part == ".") {
+      continue;
+    }
+    if (part == "..") {
+      if (!parts.empty()) {
+        parts.pop_back();
+      }
+      continue;
+    }
+    parts.push_back(part);
+  }
+  return parts;
+}
+
+// Joins the first n components into an absolute path ("/" for none).
+static string join_path(const vector<string> &parts, size_t n)
+{
+  if (n == 0) {
+    return "/";
+  }
+  string path;
+  for (size_t i = 0; i < n; i++) {
+    path += "/" + parts[i];
+  }
+  return path;
+}
+
+// Resolves path to the directory that holds its last component. The
+// longest prefix of the directory's path found in the path cache is used
+// as the starting point, so a warm cache resolves the directory without
+// reading any directory blocks. Directories read during the walk are
+// added to the cache. Returns "" on success or the error status.
+string FileSys::resolve_parent(const char *path, ResolvedPath &target)
+{
+  TraceScope span("resolve parent");
+  vector<string> parts = split_path(curr_path, path);
+  target.path = join_path(parts, parts.size());
+  target.leaf = parts.empty() ? "" : parts.back();
+  size_t dir_depth = parts.empty() ? 0 : parts.size() - 1;
+
+  // find the longest cached prefix
+  size_t known = dir_depth;
+  short dir_num = 1; // the root
+  while (known > 0) {
+    map<string, short>::iterator it = path_cache.find(join_path(parts, known));
+    if (it != path_cache.end()) {
+      if (is_directory(it->second)) {
+        dir_num = it->second;
+        volume->path_cache_hits++;
+        break;
+      }
+      path_cache.erase(it); // stale: the block was freed and reused
+    }
+    known--;
+  }
+  if (known < dir_depth) {
+    volume->path_cache_misses++;
+  }
+
+  // walk the rest of the way, caching each directory
+  for (size_t i = known; i < dir_depth; i++) {
+    struct dirblock_t dir_block;
+    bfs.read_block(dir_num, (void *) &dir_block);
+    short next = 0;
+    for (unsigned int j = 0; j < dir_block.num_entries; j++) {
+      if (parts[i] == dir_block.dir_entries[j].name) {
+        next = dir_block.dir_entries[j].block_num;
+        break;
+      }
+    }
+    if (next == 0) {
+      return "503 File does not exist";
+    }
+    if (!is_directory(next)) {
+      return "500 File is not a directory";
+    }
+    dir_num = next;
+    path_cache[join_path(parts, i + 1)] = dir_num;
+  }
+
+  target.dir_block = dir_num;
+  span.set_block(dir_num);
+  return "";
+}
+
+// Resolves path to the block of the file or directory it names. Returns
+// "" on success or the error status.
+string FileSys::resolve(const char *path, ResolvedPath &target, short &block_num)
+{
+  TraceScope span("resolve");
+  string status = resolve_parent(path, target);
+  if (!status.empty()) {
+    return status;
+  }
+
+  if (target.leaf.empty()) {
+    block_num = 1; // the root
+    return "";
+  }
+
+  // directories already in the cache need no lookup
+  map<string, short>::iterator it = path_cache.find(target.path);
+  if (it != path_cache.end()) {
+    block_num = it->second;
+    return "";
+  }
+
+  struct dirblock_t dir_block;
+  bfs.read_block(target.dir_block, (void *) &dir_block);
+  for (unsigned int i = 0; i < dir_block.num_entries; i++) {
+    if (target.leaf == dir_block.dir_entries[i].name) {
+      block_num = dir_block.dir_entries[i].block_num;
+      return "";
+    }
+  }
+  return "503 File does not exist";
+}
+
+// Resolves path to a data file and reads its inode. Returns "" on success or
+// the error status.
+string FileSys::resolve_file(const char *path, ResolvedPath &target, short &inode_block_num,
+                             struct inode_t &inode)
+{
+  string status = resolve(path, target, inode_block_num);
+  if (!status.empty()) {
+    return status;
+  }
+  bfs.read_block(inode_block_num, (void *) &inode);
+  if (inode.magic != INODE_MAGIC_NUM) {
+    return "501 File is a directory";
+  }
+  return "";
+}
+
+// Returns true if dir_path is the current directory of any session on the
+// volume, or one of its ancestors.
+bool FileSys::in_use(const string &dir_path)
+{
+  if (dir_path == "/") {
+    return true;
+  }
+  for (size_t i = 0; i < volume->sessions.size(); i++) {
+    const string &path = volume->sessions[i]->curr_path;
+    if (path == dir_path || path.compare(0, dir_path.length() + 1, dir_path + "/") == 0) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// Records that the listing or contents of path changed (and everything
+// below it, with subtree set).
+void FileSys::note_change(const string &path, bool subtree)
+{
+  out_changed.push_back(subtree && path != "/" ? path + "/" : path);
+}
+
+
+// Removes dir_path and every path below it from the path cache.
+// The paths below it run from dir_path + "/" up to dir_path + "0" ('0'
+// follows '/'); siblings such as dir_path + ".b" sort before them.
+void FileSys::forget_paths(const string &dir_path)
+{
+  path_cache.erase(dir_path);
+  path_cache.erase(path_cache.lower_bound(dir_path + "/"), path_cache.lower_bound(dir_path + "0"));
+}
+
+// Walks the tree below dir_block breadth-first. The children of every
+// directory on one level are read with a single batched read, so the walk
+// costs one read call per level (per run of consecutive blocks) instead of
+// one per entry.
+void FileSys::walk_tree(short dir_block, vector<TreeEntry> &entries)
+{
+  TraceScope span("walk tree", dir_block, 1);
+  struct dirblock_t root;
+  bfs.read_block(dir_block, (void *) &root);
+
+  // entries of the level being expanded; -1 stands for the root
+  vector<int> level(1, -1);
+  int depth = 0;
+  while (!level.empty()) {
+    vector<short> block_nums;
+    size_t first_new = entries.size();
+
+    for (size_t i = 0; i < level.size(); i++) {
+      // copy the directory: entries may reallocate as children are added
+      struct dirblock_t dir = root;
+      string prefix = "";
+      if (level[i] != -1) {
+        memcpy(&dir, &entries[level[i]].block, BLOCK_SIZE);
+        prefix = entries[level[i]].path + "/";
+      }
+      for (unsigned int j = 0; j < dir.num_entries; j++) {
+        TreeEntry entry;
+        entry.path = prefix + dir.dir_entries[j].name;
+        entry.depth = depth;
+        entry.parent = level[i];
+        entry.block_num = dir.dir_entries[j].block_num;
+        entries.push_back(entry);
+        block_nums.push_back(entry.block_num);
+      }
+    }
+
+    // read every entry of this level at once
+    vector<datablock_t> blocks(block_nums.size());
+    bfs.read_blocks(block_nums.data(), block_nums.size(), blocks.data());
+
+    vector<int> next_level;
+    for (size_t i = 0; i < block_nums.size(); i++) {
+      entries[first_new + i].block = blocks[i];
+      if (*(unsigned int *) &blocks[i] == DIR_MAGIC_NUM) {
+        next_level.push_back(first_new + i);
+      }
+    }
+    level.swap(next_level);
+    depth++;
+  }
+}
+
+// delete a file or a directory and everything below it
+string FileSys::rm_recursive(const char *path)
+{
+  // an empty name would resolve to the current directory
+  if (path[0] == '\0') {
+    return "503 File does not exist";
+  }
+  ResolvedPath target;
+  short block_num = 0;
+  string status = resolve(path, target, block_num);
+  if (!status.empty()) {
+    return status;
+  }
+  if (!is_directory(block_num)) {
+    return rm(path);
+  }
+  if (block_num == curr_dir || in_use(target.path)) {
+    return "510 Directory is in use";
+  }
+
+  // Find the entry in its directory before anything is freed
+  short dir_num = target.dir_block;
+  struct dirblock_t dir_block;
+  bfs.read_block(dir_num, (void *) &dir_block);
+  int entry_index = -1;
+  for (int i = 0; i < dir_block.num_entries; i++) {
+    if (dir_block.dir_entries[i].block_num == block_num) {
+      entry_index = i;
+      break;
+    }
+  }
+  if (entry_index == -1) {
+    return "503 File does not exist";
+  }
+
+  // collect every block in the tree, then free them with one bitmap update
+  vector<TreeEntry> entries;
+  walk_tree(block_num, entries);
+
+  vector<short> blocks_to_free(1, block_num);
+  for (size_t i = 0; i < entries.size(); i++) {
+    blocks_to_free.push_back(entries[i].block_num);
+    struct inode_t *inode = (struct inode_t *) &entries[i].block;
+    if (inode->magic == INODE_MAGIC_NUM) {
+      for (int j = 0; j < MAX_DATA_BLOCKS; j++) {
+        if (inode->blocks[j] != 0) {
+          blocks_to_free.push_back(inode->blocks[j]);
+        }
+      }
+    }
+  }
+  bfs.reclaim_blocks(blocks_to_free);
+
+  forget_paths(target.path);
+
+  // Remove the entry from its directory
+  for (int i = entry_index; i < dir_block.num_entries - 1; i++) {
+    dir_block.dir_entries[i] = dir_block.dir_entries[i + 1]; // Shift subsequent entries
+  }
+  dir_block.dir_entries[dir_block.num_entries - 1].block_num = 0;
+  memset(dir_block.dir_entries[dir_block.num_entries - 1].name, 0, MAX_FNAME_SIZE + 1);
+  dir_block.num_entries--;
+  bfs.write_block(dir_num, (void *) &dir_block);
+
+  // the removed directory's totals cover everything that was freed
+  struct dirblock_t removed;
+  bfs.read_block(block_num, (void *) &removed);
+  update_tree_totals(dir_num, -(int)removed.tree_bytes, -(int)removed.tree_blocks);
+  note_change(parent_path(target.path));
+  note_change(target.path, true);
+
+  return "200 OK"; // Success message
+}
+
+// display total bytes and blocks used by a file or directory tree.
+// Directories answer from their tree totals, so this is one block read
+// however large the tree is.
+string FileSys::du(const char *path)
+{
+  ResolvedPath target;
+  short block_num = 0;
+  string status = resolve(path, target, block_num);
+  if (!status.empty()) {
+    return status;
+  }
+
+  unsigned int total_bytes = 0;
+  int total_blocks = 0;
+  char block_buffer[BLOCK_SIZE];
+  bfs.read_block(block_num, block_buffer);
+  if (*(unsigned int *)block_buffer == DIR_MAGIC_NUM) {
+    struct dirblock_t *dir = (struct dirblock_t *)block_buffer;
+    total_bytes = dir->tree_bytes;
+    total_blocks = dir->tree_blocks;
+  } else {
+    struct inode_t *inode = (struct inode_t *)block_buffer;
+    total_bytes = inode->size;
+    total_blocks = 1; // the inode itself
+    for (int i = 0; i < MAX_DATA_BLOCKS; i++) {
+      if (inode->blocks[i] != 0) {
+        total_blocks++;
+      }
+    }
+  }
+
+  stringstream ss;
+  ss << "Total bytes: " << total_bytes << "\n";
+  ss << "Total blocks: " << total_blocks;
+  out_body = ss.str();
+  return "200 OK";
+}
+
+// display total, used and free space on the disk, and how fragmented the
+// free space is, from the free space index
+string FileSys::df()
+{
+  int free_blocks = bfs.free_block_count();
+  const FreeExtents &extents = bfs.free_extents();
+
+  stringstream ss;
+  ss << "Total blocks: " << NUM_BLOCKS << "\n";
+  ss << "Used blocks: " << NUM_BLOCKS - free_blocks << "\n";
+  ss << "Free blocks: " << free_blocks << "\n";
+  ss << "Free extents: " << extents.extent_count() << " (largest " << extents.largest_extent()
+     << " blocks)\n";
+  ss << "Free bytes: " << free_blocks * BLOCK_SIZE;
+  out_body = ss.str();
+  return "200 OK";
+}
+
+// display request counts and latencies, disk requests and path cache
+// hits of the volume
+string FileSys::stats()
+{
+  out_body = volume->report();
+  if (!out_body.empty() && out_body[out_body.length() - 1] == '\n') {
+    out_body.erase(out_body.length() - 1); // like df, no trailing newline
+  }
+  return "200 OK";
+}
+
+// request metrics of the volume
+Metrics &FileSys::metrics() {
+  return volume->metrics;
+}
+
+// Returns the request metrics, disk requests and path cache hit rate
+string Volume::report()
+{
+  const DiskStats &disk = bfs.disk_stats();
+  long lookups = path_cache_hits + path_cache_misses;
+
+  stringstream ss;
+  ss << metrics.report();
+  ss << "Disk: " << disk.reads.count() << " reads (" << disk.blocks_read << " blocks), "
+     << disk.writes.count() << " writes (" << disk.blocks_written << " blocks)\n";
+  ss << Metrics::row("disk read", disk.reads, 0);
+  ss << Metrics::row("disk write", disk.writes, 0);
+  ss << "Seeks by distance:";
+  for (int i = 0; i < DiskStats::SEEK_BUCKETS; i++) {
+    if (i < 2) {
+      ss << " " << i;
+    } else {
+      ss << " " << (1 << (i - 1)) << "-" << (1 << i) - 1;
+    }
+    ss << ":" << disk.seeks[i];
+  }
+  ss << "\n";
+  if (disk.modeled_ns > 0) {
+    ss << "Modeled device time: " << disk.modeled_ns / 1000000.0 << " ms\n";
+  }
+  if (bfs.mirror_count() > 1) {
+    ss << "Mirrors: " << bfs.mirror_status() << "\n";
+  }
+  ss << "Path cache: " << path_cache_hits << " hits, " << path_cache_misses << " misses";
+  if (lookups > 0) {
+    ss << " (" << (100 * path_cache_hits / lookups) << "% hit rate)";
+  }
+  ss << ", " << path_cache.size() << " paths\n";
+  return ss.str();
+}
+
+// display paths below the current directory whose names match pattern
+// (shell wildcards * ? [] are allowed)
+string FileSys::find(const char *pattern)
+{
+  vector<TreeEntry> entries;
+  walk_tree(curr_dir, entries);
+
+  stringstream ss;
+  for (size_t i = 0; i < entries.size(); i++) {
+    string path = entries[i].path;
+    string base = path.substr(path.rfind('/') + 1);
+    if (fnmatch(pattern, base.c_str(), 0) == 0) {
+      if (ss.tellp() > 0) {
+        ss << "\n";
+      }
+      ss << path;
+      if (*(unsigned int *) &entries[i].block == DIR_MAGIC_NUM) {
+        ss << "/";
+      }
+    }
+  }
+  if (ss.tellp() == 0) {
+    ss << "no match";
+  }
+  out_body = ss.str();
+  return "200 OK";
+}
+
+// Appends the entries below parent to ss, depth-first, indented by depth.
+static void print_tree(const vector<vector<int> > &children, int parent,
+                       const vector<string> &labels, int depth, stringstream &ss)
+{
+  const vector<int> &kids = children[parent + 1];
+  for (size_t i = 0; i < kids.size(); i++) {
+    if (ss.tellp() > 0) {
+      ss << "\n";
+    }
+    ss << string(depth * 2, ' ') << labels[kids[i]];
+    print_tree(children, kids[i], labels, depth + 1, ss);
+  }
+}
+
+// display a directory tree
+string FileSys::tree(const char *path)
+{
+  ResolvedPath target;
+  short block_num = 0;
+  string status = resolve(path, target, block_num);
+  if (!status.empty()) {
+    return status;
+  }
+  if (!is_directory(block_num)) {
+    return "500 File is not a directory";
+  }
+
+  vector<TreeEntry> entries;
+  walk_tree(block_num, entries);
+  if (entries.empty()) {
+    out_body = "empty folder";
+    return "200 OK";
+  }
+
+  // children[p + 1] lists the entries of parent p (p == -1 is the root)
+  vector<vector<int> > children(entries.size() + 1);
+  vector<string> labels(entries.size());
+  for (size_t i = 0; i < entries.size(); i++) {
+    children[entries[i].parent + 1].push_back(i);
+    string path = entries[i].path;
+    labels[i] = path.substr(path.rfind('/') + 1);
+    if (*(unsigned int *) &entries[i].block == DIR_MAGIC_NUM) {
+      labels[i] += "/";
+    }
+  }
+
+  stringstream ss;
+  print_tree(children, -1, labels, 0, ss);
+  out_body = ss.str();
+  return "200 OK";
+}
+
+// start a transaction: later changes are applied all at once on commit
+void FileSys::begin_transaction()
+{
+  saved_dir = curr_dir;
+  saved_path = curr_path;
+  bfs.begin_transaction();
+}
+
+// apply every change made since begin_transaction
+void FileSys::commit_transaction()
+{
+  bfs.commit_transaction();
+}
+
+// discard every change made since begin_transaction, including cd/home
+void FileSys::abort_transaction()
+{
+  bfs.abort_transaction();
+  curr_dir = saved_dir;
+  curr_path = saved_path;
+  path_cache.clear(); // may name directories the transaction created
+  out_changed.clear(); // nothing changed after all
+}
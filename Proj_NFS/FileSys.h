@@ -5,25 +5,152 @@
 #define FILESYS_H
 
 #include <string>       // For std::string
+#include <vector>       // For std::vector
+#include <map>          // For std::map
+#include <mutex>        // For std::mutex
 #include <sys/types.h>  // For socket types (might not be strictly needed here, but doesn't hurt)
 #include "BasicFileSys.h" // <--- CRITICAL FIX: Include the full definition here!
 #include "Blocks.h"     // Also needed for block definitions
+#include "Metrics.h"
+
+class FileSys;
+
+// A mounted disk and the state that every session (FileSys) working on it
+// shares: the path cache, the request metrics and the list of sessions. A volume owned by one
+// FileSys is private to it; the server shares one volume between all of
+// its connections, which must hold lock while they use it.
+struct Volume {
+    BasicFileSys bfs;   // basic file system
+
+    // maps absolute directory paths ("/a/b") to their directory blocks
+    std::map<std::string, short> path_cache;
+    long path_cache_hits;   // resolutions that started from a cached prefix
+    long path_cache_misses; // resolutions that had to read directories
+
+    Metrics metrics;    // requests of every session, by command
+
+    std::vector<FileSys *> sessions; // mounted sessions
+    std::mutex lock;    // held by the session running a request
+
+    Volume() : path_cache_hits(0), path_cache_misses(0) {}
+
+    // Returns the request metrics, disk requests and path cache hit rate
+    // as text.
+    std::string report();
+};
 
 class FileSys {
+public:
+    // A run of file data that is part of the response body but is sent
+    // straight from the disk file (e.g. with sendfile) instead of out_body.
+    // The full body is out_body with each extent's bytes inserted at its
+    // body_offset, in order.
+    struct DiskExtent {
+        size_t body_offset;  // position in out_body where the bytes belong
+        int disk_fd;         // file that holds the bytes
+        off_t disk_offset;   // offset of the bytes in disk_fd
+        size_t length;       // number of bytes
+    };
+
 private:
-    BasicFileSys bfs;   // basic file system
+    Volume *volume;     // disk and shared caches
+    bool owns_volume;   // true if volume belongs to this FileSys alone
+    BasicFileSys &bfs;  // volume->bfs
+    std::map<std::string, short> &path_cache; // volume->path_cache
     short curr_dir;     // current directory
+    short saved_dir;    // current directory when the transaction started
+    std::string curr_path;  // absolute path of the current directory
+    std::string saved_path; // current path when the transaction started
     int fs_sock;        // file server socket
 
+    // Absolute path read by the last command (ls, stat, cat, head), and
+    // the paths changed since clear_changes(); see read_path() and
+    // changed_paths()
+    std::string out_read_path;
+    std::vector<std::string> out_changed;
+
+    // Body of the response being built. It belongs to the connection and is
+    // reused from request to request, so its storage is allocated once.
+    std::string out_body;
+
+    // Disk ranges spliced into out_body (see DiskExtent)
+    std::vector<DiskExtent> out_extents;
+    bool zero_copy;        // true if file data may be left on the disk
+
+    // Extra response header lines of the last command, each ending in \r\n
+    std::string out_headers;
+
+    // Reads n bytes of a data file, starting at offset, into the response
+    // body
+    void read_file_data(const struct inode_t &inode, unsigned int offset, unsigned int n);
+
     // Private helper function to determine if a block is a directory
     bool is_directory(short block_num);
 
+    // One file or directory found while walking a directory tree
+    struct TreeEntry {
+        std::string path;    // path relative to the walk root
+        int depth;           // 0 for entries directly in the walk root
+        int parent;          // index of the parent entry, -1 for the root
+        short block_num;     // directory block or inode block
+        datablock_t block;   // contents of block_num
+    };
+
+    // Walks the tree below dir_block breadth-first, reading each level of
+    // the tree with one batched read. Entries of a directory are adjacent
+    // and in directory order.
+    void walk_tree(short dir_block, std::vector<TreeEntry> &entries);
+
+    // Adds bytes_delta and blocks_delta to the tree totals of dir_block
+    // and of every directory above it.
+    void update_tree_totals(short dir_block, int bytes_delta, int blocks_delta);
+
+    // A path split into the directory holding its last component and
+    // that component
+    struct ResolvedPath {
+        short dir_block;     // directory that holds leaf
+        std::string leaf;    // last component, empty for the root
+        std::string path;    // canonical absolute path
+    };
+
+    // Resolves path (absolute or relative to the current directory) to the
+    // directory holding its last component, using the path cache. Returns
+    // "" on success or the error status.
+    std::string resolve_parent(const char *path, ResolvedPath &target);
+
+    // Resolves path to the block of the file or directory it names.
+    // Returns "" on success or the error status.
+    std::string resolve(const char *path, ResolvedPath &target, short &block_num);
+
+    // Resolves path to a data file and reads its inode. Returns "" on
+    // success or the error status.
+    std::string resolve_file(const char *path, ResolvedPath &target, short &inode_block_num,
+                             struct inode_t &inode);
+
+    // Returns true if dir_path is the current directory of a session on
+    // the volume, or an ancestor of one.
+    bool in_use(const std::string &dir_path);
+
+    // Records that the listing or contents of path changed; with subtree
+    // set, everything below path changed too.
+    void note_change(const std::string &path, bool subtree = false);
+
+    // Drops dir_path and everything below it from the path cache.
+    void forget_paths(const std::string &dir_path);
+
 public:
     // Constructor
     FileSys(); // Added constructor for proper initialization
 
-    // mounts the file system
-    void mount(int sock);
+    // Constructor for a session on a volume shared with other sessions.
+    // The owner of the volume mounts its disk (volume.bfs).
+    FileSys(Volume &shared);
+
+    ~FileSys();
+
+    // mounts the file system stored in the disk file disk_name (a shared
+    // volume is already mounted; only the session starts)
+    void mount(int sock, const char *disk_name = "DISK");
 
     // unmounts the file system
     void unmount();
@@ -31,8 +158,54 @@ public:
     // make a directory
     std::string mkdir(const char *name); // Return string for RPC status
 
-    // list the contents of current directory
-    std::string ls(); // Return string for RPC status
+    // The commands below return the status line of the response
+    // ("200 OK", "503 File does not exist", ...) and leave any message body
+    // in body(). Failures: 500 not a directory, 501 is a directory, 502
+    // exists, 503 does not exist, 504 name too long, 505 disk full, 506
+    // directory full, 507 directory not empty, 508 too large for a file,
+    // 510 directory in use; and from the request layer 400 bad request,
+    // 509 batch failed, 511 no such volume (server).
+
+    // message body of the last command's response
+    std::string &body();
+
+    // parts of the body left on the disk; empty unless zero copy is enabled
+    const std::vector<DiskExtent> &body_extents();
+
+    // total body length: body() plus all extents
+    size_t body_length();
+
+    // extra response header lines of the last command ("Size:<n>\r\n" for
+    // read), "" for most commands
+    const std::string &headers();
+
+    // empties body(), body_extents() and headers() before the next command
+    void clear_response();
+
+    // lets cat and head leave contiguous file data on the disk, for
+    // connections that can transfer it with sendfile
+    void set_zero_copy(bool enabled);
+
+    // absolute path whose listing, stat or contents the last command
+    // returned; "" for other commands and errors
+    const std::string &read_path();
+
+    // absolute paths changed since clear_changes(); a trailing "/" means
+    // the path and everything below it ("/a/" for rm -r a)
+    const std::vector<std::string> &changed_paths();
+
+    // empties changed_paths()
+    void clear_changes();
+
+    // All names below may be paths, absolute ("/a/b") or relative to the
+    // current directory ("a/b", "../c").
+
+    // list the contents of a directory (the current directory by default)
+    std::string ls(const char *path = ""); // Return string for RPC status
+
+    // list up to count entries of a directory, starting at entry start,
+    // with type, size and block count ("206" if more entries remain)
+    std::string ls_long(unsigned int start, unsigned int count, const char *path = ""); // Return string for RPC status
 
     // switch to a directory
     std::string cd(const char *name); // Return string for RPC status
@@ -55,17 +228,57 @@ public:
     // display the first N bytes of the file
     std::string head(const char *name, unsigned int n); // Return string for RPC status
 
+    // return up to n bytes of a data file starting at offset, exactly as
+    // stored, with the file size in a "Size:" header
+    std::string read(const char *name, unsigned int offset, unsigned int n); // Return string for RPC status
+
+    // write length bytes of data into a data file at offset, extending the
+    // file (with zeros up to offset) as needed
+    std::string write(const char *name, unsigned int offset, const char *data,
+                      unsigned int length); // Return string for RPC status
+
     // delete a data file
     std::string rm(const char *name); // Return string for RPC status
 
     // display stats about file or directory
     std::string stat(const char *name); // Return string for RPC status
 
+    // delete a file or a directory and everything below it
+    std::string rm_recursive(const char *name); // Return string for RPC status
+
+    // display total bytes and blocks used by a file or directory tree
+    std::string du(const char *name); // Return string for RPC status
+
+    // display total, used and free space on the disk
+    std::string df(); // Return string for RPC status
+
+    // display request counts and latencies, disk requests and path cache
+    // hits of the volume
+    std::string stats(); // Return string for RPC status
+
+    // request metrics of the volume, for the dispatcher to update
+    Metrics &metrics();
+
+    // display paths below the current directory whose names match pattern
+    std::string find(const char *pattern); // Return string for RPC status
+
+    // display a directory tree
+    std::string tree(const char *name); // Return string for RPC status
+
+    // start a transaction: later changes are applied all at once on commit
+    void begin_transaction();
+
+    // apply every change made since begin_transaction
+    void commit_transaction();
+
+    // discard every change made since begin_transaction, including cd/home
+    void abort_transaction();
+
     // Note: ls_rpc() should be on the Shell class, not FileSys.
     // The FileSys class has the *local* file system operations (like ls()),
     // while the Shell class has the *remote* procedure call (RPC) functions (like ls_rpc()).
     // I've removed `std::string ls_rpc();` and `std::string get_ls_listing();` from here.
-    // The `ls()` method itself is already returning a string as needed.
+    // The `ls()` method itself leaves the listing in body() as needed.
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,127 @@
+// CPSC 3500: FreeExtents
+// Free blocks as extents, by first block and by length.
+
+#include <map>
+#include <set>
+
+using namespace std;
+
+#include "FreeExtents.h"
+
+void FreeExtents::clear() {
+    by_start.clear();
+    by_length.clear();
+    total = 0;
+}
+
+void FreeExtents::add(int start, int length) {
+    by_start[start] = length;
+    by_length.insert(make_pair(length, start));
+    total += length;
+}
+
+void FreeExtents::remove(map<int, int>::iterator extent) {
+    by_length.erase(make_pair(extent->second, extent->first));
+    total -= extent->second;
+    by_start.erase(extent);
+}
+
+void FreeExtents::insert(int start, int length) {
+    if (length <= 0) {
+        return;
+    }
+    int end = start + length;
+
+    // merge with the extent that ends at start and the one that begins
+    // at end
+    map<int, int>::iterator next = by_start.lower_bound(start);
+    if (next != by_start.begin()) {
+        map<int, int>::iterator prev = next;
+        --prev;
+        if (prev->first + prev->second == start) {
+            start = prev->first;
+            remove(prev);
+        }
+    }
+    if (next != by_start.end() && next->first == end) {
+        end += next->second;
+        remove(next);
+    }
+    add(start, end - start);
+}
+
+void FreeExtents::take(int start, int count) {
+    map<int, int>::iterator extent = by_start.upper_bound(start);
+    if (extent == by_start.begin() || count <= 0) {
+        return;
+    }
+    --extent;
+    int first = extent->first;
+    int end = first + extent->second;
+    if (start + count > end) {
+        return;
+    }
+    remove(extent);
+    if (first < start) {
+        add(first, start - first);
+    }
+    if (start + count < end) {
+        add(start + count, end - start - count);
+    }
+}
+
+int FreeExtents::find(int count, int target) const {
+    map<int, int>::const_iterator after = by_start.upper_bound(target);
+
+    // the extent holding target, if it has room from target on
+    if (after != by_start.begin()) {
+        map<int, int>::const_iterator holder = after;
+        --holder;
+        if (holder->first + holder->second >= target + count) {
+            return target;
+        }
+    }
+
+    // the nearest long enough extent among a few either side
+    int best = -1;
+    long best_distance = 0;
+    map<int, int>::const_iterator it = after;
+    for (int i = 0; i < NEAR_SCAN && it != by_start.end(); i++, ++it) {
+        if (it->second >= count) {
+            best = it->first;
+            best_distance = it->first - target;
+            break;
+        }
+    }
+    it = after;
+    for (int i = 0; i < NEAR_SCAN && it != by_start.begin(); i++) {
+        --it;
+        if (it->second >= count) {
+            int start = it->first + it->second - count; // its end is closest
+            if (best == -1 || target - start < best_distance) {
+                best = start;
+            }
+            break;
+        }
+    }
+    if (best != -1) {
+        return best;
+    }
+
+    // best fit anywhere
+    set<pair<int, int> >::const_iterator fit = by_length.lower_bound(make_pair(count, -1));
+    return fit == by_length.end() ? -1 : fit->second;
+}
+
+int FreeExtents::largest_extent() const {
+    return by_length.empty() ? 0 : by_length.rbegin()->first;
+}
+
+bool FreeExtents::contains(int block) const {
+    map<int, int>::const_iterator extent = by_start.upper_bound(block);
+    if (extent == by_start.begin()) {
+        return false;
+    }
+    --extent;
+    return block < extent->first + extent->second;
+}
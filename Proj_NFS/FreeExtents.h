@@ -0,0 +1,62 @@
+// CPSC 3500: FreeExtents
+// An in-memory index of the free blocks of a disk as extents (runs of
+// consecutive free blocks), kept both by first block and by length so
+// that "count contiguous blocks near block X" takes logarithmic time
+// however full or large the disk is. The bitmaps on disk stay the record
+// of what is free; the index is rebuilt from them at mount.
+
+#ifndef FREE_EXTENTS_H
+#define FREE_EXTENTS_H
+
+#include <map>
+#include <set>
+#include <utility>
+
+class FreeExtents {
+
+  public:
+    // Extents either side of the target looked at before settling for
+    // the best fit anywhere
+    static const int NEAR_SCAN = 8;
+
+    // Forgets every extent.
+    void clear();
+
+    // Marks blocks [start, start + length) free, merging them with the
+    // extents on either side. None of them may be free already.
+    void insert(int start, int length);
+
+    // Marks blocks [start, start + count) used. They must lie in one
+    // free extent.
+    void take(int start, int count);
+
+    // Finds count contiguous free blocks as close to target as it can:
+    // starting at target if it is free, else in the nearest extent long
+    // enough among the NEAR_SCAN either side of it (following it on a
+    // tie), else in the shortest extent long enough anywhere. Returns the
+    // first block, or -1 if no extent is long enough.
+    int find(int count, int target) const;
+
+    // Returns true if block is free.
+    bool contains(int block) const;
+
+    // Number of free blocks.
+    int free_blocks() const { return total; }
+
+    // Number of extents the free blocks are split into.
+    int extent_count() const { return by_start.size(); }
+
+    // Length of the longest extent, 0 if no block is free.
+    int largest_extent() const;
+
+  private:
+    std::map<int, int> by_start;                // first block -> length
+    std::set<std::pair<int, int> > by_length;   // (length, first block)
+    int total = 0;
+
+    // Adds and removes an extent from both orders.
+    void add(int start, int length);
+    void remove(std::map<int, int>::iterator extent);
+};
+
+#endif
@@ -0,0 +1,65 @@
+// CPSC 3500: Leases
+// Records which sessions may cache which paths.
+
+using namespace std;
+
+#include "Lease.h"
+
+// Lets session cache path until expires
+void LeaseTable::grant(const string &path, int session, Clock::time_point expires) {
+    leases[path][session] = expires;
+}
+
+// Ends the leases on the changed paths
+map<int, vector<string> > LeaseTable::revoke(const vector<string> &changed) {
+    map<int, vector<string> > holders;
+    Clock::time_point now = Clock::now();
+    for (size_t i = 0; i < changed.size(); i++) {
+        const string &path = changed[i];
+        if (path.length() > 1 && path[path.length() - 1] == '/') {
+            // the directory, then everything below it: the paths from
+            // dir + "/" up to dir + "0" ('0' follows '/'), past siblings
+            // such as dir + ".txt" that sort before them
+            string dir = path.substr(0, path.length() - 1);
+            map<string, map<int, Clock::time_point> >::iterator it = leases.find(dir);
+            if (it != leases.end()) {
+                revoke_path(it, now, holders);
+            }
+            it = leases.lower_bound(path);
+            map<string, map<int, Clock::time_point> >::iterator end = leases.lower_bound(dir + "0");
+            while (it != end) {
+                revoke_path(it++, now, holders);
+            }
+        } else {
+            map<string, map<int, Clock::time_point> >::iterator it = leases.find(path);
+            if (it != leases.end()) {
+                revoke_path(it, now, holders);
+            }
+        }
+    }
+    return holders;
+}
+
+void LeaseTable::revoke_path(map<string, map<int, Clock::time_point> >::iterator it,
+                             Clock::time_point now, map<int, vector<string> > &holders) {
+    map<int, Clock::time_point> &sessions = it->second;
+    for (map<int, Clock::time_point>::iterator s = sessions.begin(); s != sessions.end(); s++) {
+        if (s->second > now) {
+            holders[s->first].push_back(it->first);
+        }
+    }
+    leases.erase(it);
+}
+
+// Ends every lease held by session
+void LeaseTable::release(int session) {
+    map<string, map<int, Clock::time_point> >::iterator it = leases.begin();
+    while (it != leases.end()) {
+        it->second.erase(session);
+        if (it->second.empty()) {
+            leases.erase(it++);
+        } else {
+            it++;
+        }
+    }
+}
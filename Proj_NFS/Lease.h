@@ -0,0 +1,40 @@
+// CPSC 3500: Leases
+// Records which sessions may cache which paths. A session holding a lease
+// on a path may answer ls, stat, cat and head for it from its own cache
+// until the lease expires; the server revokes the lease (and tells the
+// session) as soon as another request changes the path.
+
+#ifndef LEASE_H
+#define LEASE_H
+
+#include <string>
+#include <vector>
+#include <map>
+#include <chrono>
+
+class LeaseTable {
+
+  public:
+    typedef std::chrono::steady_clock Clock;
+
+    // Lets session cache path until expires.
+    void grant(const std::string &path, int session, Clock::time_point expires);
+
+    // Ends the leases on the changed paths. A path ending in "/" ends the
+    // leases on that path and on everything below it. Returns, for each
+    // session that held an unexpired lease, the paths it must drop.
+    std::map<int, std::vector<std::string> > revoke(const std::vector<std::string> &changed);
+
+    // Ends every lease held by session.
+    void release(int session);
+
+  private:
+    // Ends the leases on path, adding unexpired ones to holders.
+    void revoke_path(std::map<std::string, std::map<int, Clock::time_point> >::iterator it,
+                     Clock::time_point now, std::map<int, std::vector<std::string> > &holders);
+
+    // path -> session -> expiry
+    std::map<std::string, std::map<int, Clock::time_point> > leases;
+};
+
+#endif
@@ -0,0 +1,46 @@
+// CPSC 3500: LocalChannel
+// Runs the file system inside the shell process (embedded mode). Requests
+// written to the channel go through the server's command dispatch when
+// the shell reads the channel, and the responses come back in the server's
+// format, so the shell drives it exactly like a server.
+
+#ifndef LOCAL_CHANNEL_H
+#define LOCAL_CHANNEL_H
+
+#include <string>
+#include "Channel.h"
+#include "Dispatch.h"
+#include "FileSys.h"
+
+class LocalChannel : public Channel {
+
+  public:
+    // Mounts the file system stored in the disk file disk_name, creating
+    // and formatting it if it does not exist.
+    LocalChannel(const std::string &disk_name);
+
+    ~LocalChannel();
+
+    // Queues requests for the file system.
+    ssize_t sendv(struct iovec *iov, int iov_count, bool more);
+    ssize_t send_file(int file_fd, off_t offset, size_t length);
+
+    // Returns response bytes, running the next queued request when all
+    // earlier responses have been read. Returns 0 if no request is queued.
+    ssize_t recv(void *buf, size_t len);
+
+    // True while part of a response is unread; requests only run in recv().
+    bool has_data();
+
+    // Unmounts the file system.
+    void close();
+
+  private:
+    FileSys fs;             // the mounted file system
+    RequestReader reader;   // requests not yet run
+    std::string responses;  // responses not yet read
+    size_t responses_pos;   // start of the unread part of responses
+    bool mounted;           // true until close()
+};
+
+#endif
@@ -0,0 +1,130 @@
+// CPSC 3500: Logger
+// Leveled logging through a lock-free ring drained by a background thread.
+
+#include <chrono>
+#include <cctype>     // For tolower
+
+using namespace std;
+
+#include "Logger.h"
+
+// How long the writer thread sleeps when the ring is empty
+static const int IDLE_SLEEP_MS = 5;
+
+static const char *level_names[] = {"ERROR", "WARN", "INFO", "DEBUG", "TRACE"};
+
+Logger::Logger(size_t capacity)
+    : write_pos(0), read_pos(0), dropped(0), max_level(LOG_INFO), sample_count(0),
+      sample_every(1), out(NULL), stopping(false) {
+    size_t size = 2;
+    while (size < capacity) {
+        size *= 2;
+    }
+    slots = new Slot[size];
+    mask = size - 1;
+    for (size_t i = 0; i < size; i++) {
+        slots[i].sequence.store(i, memory_order_relaxed);
+    }
+}
+
+Logger::~Logger() {
+    stop();
+    delete[] slots;
+}
+
+void Logger::start(ostream &stream) {
+    out = &stream;
+    stopping.store(false);
+    writer = thread(&Logger::run, this);
+}
+
+void Logger::stop() {
+    if (writer.joinable()) {
+        stopping.store(true);
+        writer.join();
+    }
+}
+
+bool Logger::parse_level(const string &name, LogLevel &level) {
+    for (int i = LOG_ERROR; i <= LOG_TRACE; i++) {
+        string lower = level_names[i];
+        for (size_t c = 0; c < lower.length(); c++) {
+            lower[c] = tolower(lower[c]);
+        }
+        if (name == lower) {
+            level = (LogLevel) i;
+            return true;
+        }
+    }
+    return false;
+}
+
+// Claims the next free slot with a compare-and-swap on write_pos (a
+// bounded multi-producer queue); gives up at once if the ring is full
+void Logger::log(LogLevel level, const string &message) {
+    if (!enabled(level)) {
+        return;
+    }
+    size_t pos = write_pos.load(memory_order_relaxed);
+    Slot *slot;
+    while (true) {
+        slot = &slots[pos & mask];
+        size_t sequence = slot->sequence.load(memory_order_acquire);
+        long diff = (long) sequence - (long) pos;
+        if (diff == 0) {
+            if (write_pos.compare_exchange_weak(pos, pos + 1, memory_order_relaxed)) {
+                break;
+            }
+        } else if (diff < 0) {
+            dropped.fetch_add(1, memory_order_relaxed); // the writer is behind
+            return;
+        } else {
+            pos = write_pos.load(memory_order_relaxed);
+        }
+    }
+
+    slot->level = level;
+    if (message.length() <= MAX_MESSAGE) {
+        slot->message = message;
+    } else {
+        slot->message.assign(message, 0, MAX_MESSAGE);
+        slot->message += "... (" + to_string(message.length() - MAX_MESSAGE) + " more bytes)";
+    }
+    slot->sequence.store(pos + 1, memory_order_release);
+}
+
+// Writes out every message whose slot is filled, in order, then notes how
+// many were dropped since the last report
+bool Logger::drain() {
+    bool any = false;
+    while (true) {
+        Slot &slot = slots[read_pos & mask];
+        if (slot.sequence.load(memory_order_acquire) != read_pos + 1) {
+            break;
+        }
+        *out << "[" << level_names[slot.level] << "] " << slot.message << "\n";
+        slot.message.clear();
+        slot.sequence.store(read_pos + mask + 1, memory_order_release);
+        read_pos++;
+        any = true;
+    }
+    unsigned long lost = dropped.exchange(0, memory_order_relaxed);
+    if (lost > 0) {
+        *out << "[" << level_names[LOG_WARN] << "] " << lost << " log messages dropped\n";
+    }
+    if (any || lost > 0) {
+        out->flush();
+    }
+    return any;
+}
+
+void Logger::run() {
+    while (true) {
+        if (!drain()) {
+            if (stopping.load()) {
+                break;
+            }
+            this_thread::sleep_for(chrono::milliseconds(IDLE_SLEEP_MS));
+        }
+    }
+}
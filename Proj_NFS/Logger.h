@@ -0,0 +1,96 @@
+// CPSC 3500: Logger
+// Leveled logging for the server. Request threads hand messages to a
+// fixed-size lock-free ring and return at once; a background thread
+// writes them out. When the ring is full, messages are dropped (and
+// counted) rather than making a request wait.
+
+#ifndef LOGGER_H
+#define LOGGER_H
+
+#include <string>
+#include <atomic>
+#include <thread>
+#include <ostream>
+
+enum LogLevel {
+    LOG_ERROR,  // failures
+    LOG_WARN,   // dropped messages and other surprises
+    LOG_INFO,   // connections, periodic stats, sampled requests
+    LOG_DEBUG,  // every request
+    LOG_TRACE   // every response, header and body
+};
+
+class Logger {
+
+  public:
+    // A ring of capacity messages (rounded up to a power of two).
+    Logger(size_t capacity = 4096);
+
+    // Writes out what is queued and stops the writer thread.
+    ~Logger();
+
+    // Starts the writer thread, which writes to out.
+    void start(std::ostream &out);
+
+    // Writes out what is queued and stops the writer thread.
+    void stop();
+
+    // Messages above level are not logged (default LOG_INFO).
+    void set_level(LogLevel level) { max_level.store(level, std::memory_order_relaxed); }
+
+    // Returns true if messages at level are logged; check it before
+    // building an expensive message.
+    bool enabled(LogLevel level) const {
+        return level <= max_level.load(std::memory_order_relaxed);
+    }
+
+    // Lets one in every n sampled events through (default 1: all).
+    void set_sample_every(unsigned long n) { sample_every = n > 0 ? n : 1; }
+
+    // Returns true for one in every sample_every calls, for events too
+    // frequent to log each time.
+    bool sample() {
+        return sample_count.fetch_add(1, std::memory_order_relaxed) % sample_every == 0;
+    }
+
+    // Queues message at level without waiting. Messages longer than
+    // MAX_MESSAGE are cut short.
+    void log(LogLevel level, const std::string &message);
+
+    // Parses "error", "warn", "info", "debug" or "trace". Returns false for
+    // anything else.
+    static bool parse_level(const std::string &name, LogLevel &level);
+
+    static const size_t MAX_MESSAGE = 16384;
+
+  private:
+    // One queued message. sequence says whose turn the slot is: equal to
+    // the write position when free for it, one more once the message is
+    // in and can be read.
+    struct Slot {
+        std::atomic<size_t> sequence;
+        LogLevel level;
+        std::string message;
+    };
+
+    // Writes out queued messages. Returns false if there were none.
+    bool drain();
+
+    // Body of the writer thread
+    void run();
+
+    Slot *slots;
+    size_t mask;                        // ring size - 1
+    std::atomic<size_t> write_pos;      // next slot to fill, shared by producers
+    size_t read_pos;                    // next slot to drain, writer thread only
+    std::atomic<unsigned long> dropped; // messages lost to a full ring
+    std::atomic<int> max_level;
+    std::atomic<unsigned long> sample_count;
+    unsigned long sample_every;
+
+    std::ostream *out;
+    std::thread writer;
+    std::atomic<bool> stopping;
+};
+
+#endif
@@ -0,0 +1,126 @@
+// CPSC 3500: Metrics
+// Request counters and latency histograms.
+
+#include <cstdio>
+#include <sstream>
+
+using namespace std;
+
+#include "Metrics.h"
+
+LatencyHistogram::LatencyHistogram()
+    : buckets(bucket_of(MAX_NS) + 1, 0), total(0), sum(0), largest(0) {}
+
+// Values below 2 * SUB_BUCKETS have a bucket each; above that, a value
+// whose highest set bit is msb falls in one of the SUB_BUCKETS buckets of
+// width 2^(msb - SUB_BITS) that cover [2^msb, 2^(msb+1)).
+int LatencyHistogram::bucket_of(long long ns) {
+    if (ns < 2 * SUB_BUCKETS) {
+        return (int) ns;
+    }
+    int msb = 63 - __builtin_clzll((unsigned long long) ns);
+    int shift = msb - SUB_BITS;
+    return (shift + 1) * SUB_BUCKETS + (int) ((ns >> shift) - SUB_BUCKETS);
+}
+
+long long LatencyHistogram::bucket_max(int index) {
+    if (index < 2 * SUB_BUCKETS) {
+        return index;
+    }
+    int shift = index / SUB_BUCKETS - 1;
+    long long low = (long long) (SUB_BUCKETS + index % SUB_BUCKETS) << shift;
+    return low + (1LL << shift) - 1;
+}
+
+// Counts one latency
+void LatencyHistogram::record(long long ns) {
+    if (ns < 0) {
+        ns = 0;
+    } else if (ns > MAX_NS) {
+        ns = MAX_NS;
+    }
+    buckets[bucket_of(ns)]++;
+    total++;
+    sum += ns;
+    if (ns > largest) {
+        largest = ns;
+    }
+}
+
+double LatencyHistogram::mean() const {
+    return total == 0 ? 0 : (double) sum / total;
+}
+
+// Walks the buckets up to the one holding the value of rank p% (nearest
+// rank), never reporting more than the largest value seen
+long long LatencyHistogram::percentile(double p) const {
+    if (total == 0) {
+        return 0;
+    }
+    long long rank = (long long) (p / 100 * total + 0.999999);
+    if (rank < 1) {
+        rank = 1;
+    }
+    long long seen = 0;
+    for (size_t i = 0; i < buckets.size(); i++) {
+        seen += buckets[i];
+        if (seen >= rank) {
+            long long value = bucket_max(i);
+            return value < largest ? value : largest;
+        }
+    }
+    return largest;
+}
+
+Metrics::Metrics() : started(Clock::now()) {}
+
+// Counts a request for command
+void Metrics::record_request(const string &command, long long ns, bool ok) {
+    map<string, CommandStats>::iterator it = commands.find(command);
+    if (it == commands.end()) {
+        // unknown names are up to the client; keep the table bounded
+        it = commands.insert(make_pair(commands.size() < MAX_COMMANDS ? command : "other",
+                                       CommandStats())).first;
+    }
+    it->second.latency.record(ns);
+    if (!ok) {
+        it->second.errors++;
+    }
+}
+
+string Metrics::header_row() {
+    char line[160];
+    snprintf(line, sizeof(line), "%-12s %9s %7s %9s %9s %9s %9s %9s %9s\n", "command", "count",
+             "errors", "mean us", "p50 us", "p95 us", "p99 us", "p999 us", "max us");
+    return line;
+}
+
+string Metrics::row(const string &name, const LatencyHistogram &histogram, long long errors) {
+    char line[200];
+    snprintf(line, sizeof(line), "%-12s %9lld %7lld %9.1f %9.1f %9.1f %9.1f %9.1f %9.1f\n",
+             name.c_str(), histogram.count(), errors, histogram.mean() / 1000,
+             histogram.percentile(50) / 1000.0, histogram.percentile(95) / 1000.0,
+             histogram.percentile(99) / 1000.0, histogram.percentile(99.9) / 1000.0,
+             histogram.max() / 1000.0);
+    return line;
+}
+
+// Summary line and one row per command
+string Metrics::report() const {
+    long long requests = 0;
+    long long errors = 0;
+    for (map<string, CommandStats>::const_iterator it = commands.begin(); it != commands.end(); it++) {
+        requests += it->second.latency.count();
+        errors += it->second.errors;
+    }
+    double uptime = chrono::duration<double>(Clock::now() - started).count();
+
+    stringstream ss;
+    ss << "Uptime: " << (long long) uptime << " s, " << requests << " requests ("
+       << errors << " errors)\n";
+    ss << header_row();
+    for (map<string, CommandStats>::const_iterator it = commands.begin(); it != commands.end(); it++) {
+        ss << row(it->first, it->second.latency, it->second.errors);
+    }
+    return ss.str();
+}
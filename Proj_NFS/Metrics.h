@@ -0,0 +1,89 @@
+// CPSC 3500: Metrics
+// Request counters and latency histograms. The server keeps one set per
+// volume; "stats" requests and the server's periodic dump report them.
+
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <string>
+#include <vector>
+#include <map>
+#include <chrono>
+
+// Latencies in nanoseconds, counted in buckets whose width grows with the
+// value (HDR style): each power of two is split into SUB_BUCKETS equal
+// buckets, so every reported value is within 1/SUB_BUCKETS of the truth
+// while the whole range up to MAX_NS takes a few hundred counters.
+class LatencyHistogram {
+
+  public:
+    LatencyHistogram();
+
+    // Counts one latency of ns nanoseconds (clamped to MAX_NS).
+    void record(long long ns);
+
+    // Number of latencies recorded.
+    long long count() const { return total; }
+
+    // Mean and largest latency in ns, 0 if none was recorded.
+    double mean() const;
+    long long max() const { return largest; }
+
+    // Returns the p-th percentile (0-100) in ns: the upper end of the
+    // bucket holding it, 0 if none was recorded.
+    long long percentile(double p) const;
+
+    static const long long MAX_NS = (1LL << 40) - 1; // about 18 minutes
+
+  private:
+    static const int SUB_BITS = 4;
+    static const int SUB_BUCKETS = 1 << SUB_BITS;
+
+    // Returns the bucket of ns and the largest value of bucket index.
+    static int bucket_of(long long ns);
+    static long long bucket_max(int index);
+
+    std::vector<long long> buckets;
+    long long total;
+    long long sum;
+    long long largest;
+};
+
+// Requests and their latencies by command name. Not thread-safe; the
+// server updates and reads it with the volume locked.
+class Metrics {
+
+  public:
+    typedef std::chrono::steady_clock Clock;
+
+    Metrics();
+
+    // Counts a request for command that took ns and failed unless ok.
+    // Beyond MAX_COMMANDS distinct names, requests count under "other".
+    void record_request(const std::string &command, long long ns, bool ok);
+
+    // Returns the request counts and latencies as text: a summary line and
+    // one table row per command.
+    std::string report() const;
+
+    // Formats one table row for histogram (and its error count) in
+    // microseconds; header_row() labels the columns.
+    static std::string row(const std::string &name, const LatencyHistogram &histogram,
+                           long long errors);
+    static std::string header_row();
+
+  private:
+    static const size_t MAX_COMMANDS = 64;
+
+    struct CommandStats {
+        LatencyHistogram latency;
+        long long errors;
+
+        CommandStats() : errors(0) {}
+    };
+
+    std::map<std::string, CommandStats> commands;
+    Clock::time_point started;
+};
+
+#endif
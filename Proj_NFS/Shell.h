@@ -5,10 +5,15 @@
 #define SHELL_H
 
 #include <string>
+#include <deque>
+#include <vector>
+#include <map>
+#include <chrono>
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
 #include <netdb.h>
+#include "Channel.h"
 
 // Shell
 class Shell {
@@ -18,7 +23,7 @@ class Shell {
     Shell(); // Declaration only, implementation in Shell.cpp
 
     // Mount a network file system located in host:port, set is_mounted = true if success
-    void mountNFS(string fs_loc);  //fs_loc must be in the format of server:port
+    void mountNFS(string fs_loc);  //fs_loc must be in the format of server:port, unix:/socket/path, shm:name or local:disk_file; all but local: may end in @volume
 
     //unmount the mounted network file syste,
     void unmountNFS();
@@ -29,13 +34,39 @@ class Shell {
     // Execute a script.
     void run_script(char *file_name);
 
+    // Sets the number of script requests kept in flight (default 16).
+    void set_pipeline_window(int window);
+
+    // Buffers consecutive appends to a file, up to limit bytes, and sends
+    // them as one request (0, the default, sends every append at once).
+    void set_write_back(size_t limit);
+
+    // Sets how many connections a put or get may use at once (default 1).
+    void set_transfer_streams(int streams);
+
   private:
     
     int cs_sock; //socket to the network file system server
 
+    Channel *cs_channel = NULL; //channel to the server (wraps cs_sock unless shm or local)
+
+    string socket_loc; //server:port or unix:/socket/path of the mount, "" for shm and local
+
+    string volume_name; //server volume chosen at mount, "" for the server's default
+
+    string remote_dir = "/"; //the session's current directory, for extra put and get connections
+
+    int transfer_streams = 1; //max connections used by one put or get
+
 
     bool is_mounted; //true if the network file system is mounted, false otherise
 
+    int pipeline_window = 16; //max requests in flight while running a script
+
+    string recv_buffer; //bytes received from the server but not yet parsed
+
+    bool in_batch = false; //true between "batch" and "end"
+
     // data structure for command line
     struct Command
     {
@@ -44,9 +75,110 @@ class Shell {
       string append_data;	// append data (append only)
     };
 
+    vector<Command> batch_commands; //commands collected for the open batch
+
+    // script request that has been sent but whose response is not displayed
+    struct PendingRequest
+    {
+      string command_str;	// script line, echoed with the response
+      struct Command command;	// parsed command
+      chrono::steady_clock::time_point sent;	// when the request was sent
+    };
+
+    // result of an ls, stat, cat or head kept under a lease from the server
+    struct CacheEntry
+    {
+      string path;		// absolute path the lease covers
+      string body;		// response body
+      chrono::steady_clock::time_point expires;	// end of the lease
+    };
+
+    bool cache_enabled = false; //true if the server grants leases
+
+    map<string, CacheEntry> cache; //cached results by request line
+
+    long cache_hits = 0; //commands answered from the cache
+    long cache_misses = 0; //cacheable commands sent to the server
+    long cache_invalidations = 0; //entries dropped at the server's request
+
+    size_t write_back_limit = 0; //bytes of appends buffered before a flush, 0 for none
+
+    Command write_back = {"", "", ""}; //buffered appends as one append, blank name if none
+
+    chrono::steady_clock::time_point write_back_deadline; //flush time of the buffer
+
     // Executes the command. Returns true for quit and false otherwise.
     bool execute_command(string command_str);
 
+    // Executes a parsed command. Returns true for quit and false otherwise.
+    bool execute_parsed_command(struct Command command);
+
+    // Returns true if command may be pipelined behind earlier requests.
+    bool is_pipelined(struct Command &command);
+
+    // Builds the request message sent to the server for command.
+    string request_line(const Command &command);
+
+    // Sends the request for command without waiting for the response.
+    bool send_request(const Command &command);
+
+    // Receives the next response and displays it for command, sent at sent.
+    bool receive_response(const Command &command, chrono::steady_clock::time_point sent);
+
+    // Receives the next response, applying pushed invalidations on the way.
+    bool receive_message(int &status_code, string &status_message,
+                         string &body_content, map<string, string> &headers);
+
+    // Asks the server for leases; turns the cache on if it grants them.
+    void enable_cache();
+
+    // Selects the mounted volume on a new connection. Returns false, with
+    // the connection closed, if the server has no such volume.
+    bool open_volume();
+
+    // Returns true for commands whose results may be cached.
+    bool is_cacheable(const Command &command);
+
+    // Displays command's result from the cache. Returns true on a hit.
+    bool cache_lookup(const Command &command);
+
+    // Caches a response that came with a lease.
+    void cache_response(const Command &command, chrono::steady_clock::time_point sent,
+                        int status_code, const string &body_content, const string &lease);
+
+    // Follows a successful cd or home in remote_dir.
+    void track_directory(const Command &command);
+
+    // Drops cached results for the paths in an invalidation message body.
+    void apply_invalidation(const string &paths);
+
+    // Applies invalidations that arrived while no request was outstanding.
+    void drain_invalidations();
+
+    // Prints cache hits, misses and invalidations ("cache" command).
+    void print_cache_stats();
+
+    // Adds an append to the write-back buffer and reports it done. Appends
+    // to another file flush the buffer first.
+    void buffer_append(const Command &command);
+
+    // Returns true if command must not run before the buffered appends are
+    // sent: every request except another append to the same file.
+    bool needs_flush(const Command &command);
+
+    // Sends the buffered appends, if any, and reports a failure.
+    void flush_write_back();
+
+    // Displays a server response the way command expects.
+    void display_response(const Command &command, int status_code,
+                          const string &status_message, const string &body_content);
+
+    // Sends command and waits for its response.
+    void rpc(const Command &command);
+
+    // Receives and displays the response to the oldest in-flight request.
+    bool complete_request(deque<PendingRequest> &in_flight);
+
     // Parses a command line into a command struct. Returned name is blank
     // for invalid command lines.
     struct Command parse_command(string command_str);
@@ -66,6 +198,9 @@ class Shell {
     // Remote procedure call on ls
     void ls_rpc();
 
+    // Remote procedure calls on ls -l, one per page of entries
+    void ls_long_rpc(string dname);
+
     // Remote procedure call on create
     void create_rpc(string fname);
 
@@ -83,6 +218,27 @@ class Shell {
 
     // Remote procedure call on stat
     void stat_rpc(string fname); 
+
+    // Remote procedure call that runs the collected batch as one transaction
+    void batch_rpc();
+
+    // Remote procedure calls that copy the local file local_name to a new
+    // file remote_name
+    void put_rpc(string local_name, string remote_name);
+
+    // Remote procedure calls that copy the file remote_name to the local
+    // file local_name
+    void get_rpc(string remote_name, string local_name);
+
+    // Moves length bytes at offset between the local file fd and the file
+    // remote over channel. Returns "" on success or the error.
+    string transfer_range(Channel *channel, string &buffer, bool put, const string &remote,
+                          int fd, size_t offset, size_t length);
+
+    // Moves length bytes at offset like transfer_range, split over up to
+    // transfer_streams connections. Returns "" on success or the error.
+    string parallel_transfer(bool put, const string &remote, int fd, size_t offset,
+                             size_t length);
 };
 
 #endif
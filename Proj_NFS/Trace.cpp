@@ -0,0 +1,152 @@
+// CPSC 3500: Trace
+// Timed spans of a request, written out in Chrome trace-event format.
+
+#include <cstdio>
+
+using namespace std;
+
+#include "Trace.h"
+
+static thread_local Trace *thread_trace = NULL;
+
+// Nanoseconds on the steady clock
+static long long now_ns() {
+    return chrono::duration_cast<chrono::nanoseconds>(Trace::Clock::now().time_since_epoch()).count();
+}
+
+// Escapes s for use inside a JSON string
+static string json_escape(const string &s) {
+    string out;
+    for (size_t i = 0; i < s.length(); i++) {
+        unsigned char c = s[i];
+        if (c == '"' || c == '\\') {
+            out += '\\';
+            out += c;
+        } else if (c < 0x20) {
+            char code[8];
+            snprintf(code, sizeof(code), "\\u%04x", c);
+            out += code;
+        } else {
+            out += c;
+        }
+    }
+    return out;
+}
+
+void Trace::begin(const string &request_line) {
+    request = request_line;
+    spans.clear();
+    dropped = 0;
+    open(request_line.substr(0, request_line.find(' ')), -1, 0); // named after the command
+}
+
+void Trace::end() {
+    close(0, -1);
+}
+
+long long Trace::duration_ns() const {
+    return spans.empty() ? 0 : spans[0].end_ns - spans[0].start_ns;
+}
+
+int Trace::open(const string &name, int block, int count) {
+    if (spans.size() >= MAX_SPANS) {
+        dropped++;
+        return -1;
+    }
+    Span span = {name, now_ns(), 0, block, count};
+    spans.push_back(span);
+    return spans.size() - 1;
+}
+
+void Trace::close(int span, int block) {
+    if (span < 0 || (size_t) span >= spans.size()) {
+        return;
+    }
+    spans[span].end_ns = now_ns();
+    if (block != -1) {
+        spans[span].block = block;
+    }
+}
+
+// One complete ("X") event per span; timestamps and durations are in
+// microseconds. The root span carries the request line.
+void Trace::append_events(string &out, int tid) const {
+    for (size_t i = 0; i < spans.size(); i++) {
+        const Span &span = spans[i];
+        char times[96];
+        snprintf(times, sizeof(times), "\"ts\": %.3f, \"dur\": %.3f, \"pid\": 1, \"tid\": %d",
+                 span.start_ns / 1000.0, (span.end_ns - span.start_ns) / 1000.0, tid);
+        if (i > 0) {
+            out += ",\n";
+        }
+        out += "{\"name\": \"" + json_escape(span.name) + "\", \"cat\": \"nfs\", \"ph\": \"X\", ";
+        out += times;
+        out += ", \"args\": {";
+        if (i == 0) {
+            out += "\"request\": \"" + json_escape(request) + "\"";
+            if (dropped > 0) {
+                out += ", \"dropped_spans\": " + to_string(dropped);
+            }
+        } else {
+            if (span.block != -1) {
+                out += "\"block\": " + to_string(span.block);
+            }
+            if (span.count > 1) {
+                out += string(span.block != -1 ? ", " : "") + "\"blocks\": " + to_string(span.count);
+            }
+        }
+        out += "}}";
+    }
+}
+
+Trace *current_trace() {
+    return thread_trace;
+}
+
+void set_current_trace(Trace *trace) {
+    thread_trace = trace;
+}
+
+TraceScope::TraceScope(const char *name, int block, int count)
+    : trace(thread_trace), span(-1), end_block(-1) {
+    if (trace != NULL) {
+        span = trace->open(name, block, count);
+    }
+}
+
+TraceScope::~TraceScope() {
+    if (trace != NULL) {
+        trace->close(span, end_block);
+    }
+}
+
+TraceWriter::~TraceWriter() {
+    if (file != NULL) {
+        fclose(file);
+    }
+}
+
+bool TraceWriter::open(const string &file_name) {
+    file = fopen(file_name.c_str(), "w");
+    if (file == NULL) {
+        return false;
+    }
+    fputs("[\n", file);
+    fflush(file);
+    return true;
+}
+
+void TraceWriter::write(const Trace &trace, int tid) {
+    string events;
+    trace.append_events(events, tid);
+    lock_guard<mutex> guard(lock);
+    if (file == NULL || events.empty()) {
+        return;
+    }
+    if (!first) {
+        fputs(",\n", file);
+    }
+    fputs(events.c_str(), file);
+    fflush(file);
+    first = false;
+}
@@ -0,0 +1,104 @@
+// CPSC 3500: Trace
+// Timed spans of a single request, from the server's request loop through
+// the dispatcher and FileSys down to BasicFileSys and Disk, with the block
+// numbers involved. The trace of the request running on a thread is that
+// thread's current trace; code below the server opens spans with a
+// TraceScope and costs nothing more when no trace is current.
+
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <string>
+#include <vector>
+#include <mutex>
+#include <chrono>
+#include <cstdio>
+
+class Trace {
+
+  public:
+    typedef std::chrono::steady_clock Clock;
+
+    // Spans beyond this many are counted but not kept (e.g. rm -r of a
+    // large tree)
+    static const size_t MAX_SPANS = 10000;
+
+    // Starts the trace of request, with its root span (named after the
+    // command) open.
+    void begin(const std::string &request);
+
+    // Closes the root span.
+    void end();
+
+    // Time from begin() to end() in nanoseconds.
+    long long duration_ns() const;
+
+    // Opens a span nested in the open ones. block and count (-1 and 0 if
+    // none) are the first block and number of blocks it works on. Returns
+    // the span's index for close(), or -1 if it was not kept.
+    int open(const std::string &name, int block, int count);
+
+    // Closes span, setting its block if block is not -1.
+    void close(int span, int block);
+
+    // Appends the spans as Chrome trace events ("X" events, comma
+    // separated, no enclosing brackets) on thread tid.
+    void append_events(std::string &out, int tid) const;
+
+  private:
+    struct Span {
+        std::string name;
+        long long start_ns;
+        long long end_ns;
+        int block;
+        int count;
+    };
+
+    std::string request;     // request line of the root span
+    std::vector<Span> spans; // in the order they were opened
+    size_t dropped = 0;      // spans not kept
+};
+
+// The trace of the request running on this thread, NULL if none.
+Trace *current_trace();
+
+// Makes trace (NULL for none) the current trace of this thread.
+void set_current_trace(Trace *trace);
+
+// A span of the current trace, open for the scope of the object.
+class TraceScope {
+
+  public:
+    TraceScope(const char *name, int block = -1, int count = 0);
+    ~TraceScope();
+
+    // Sets the block of the span once it is known (e.g. an allocation).
+    void set_block(int block) { end_block = block; }
+
+  private:
+    Trace *trace;
+    int span;
+    int end_block;
+};
+
+// Collects traces in a file in Chrome's trace-event JSON array format
+// (load it in chrome://tracing or Perfetto). The closing bracket is left
+// off, which the format allows, so traces can be added while it is open.
+class TraceWriter {
+
+  public:
+    ~TraceWriter();
+
+    // Creates file_name. Returns false if it cannot be written.
+    bool open(const std::string &file_name);
+
+    // Adds trace, recorded on thread tid. Safe to call from any thread.
+    void write(const Trace &trace, int tid);
+
+  private:
+    FILE *file = NULL;
+    bool first = true;      // no event written yet
+    std::mutex lock;
+};
+
+#endif
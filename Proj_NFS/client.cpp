@@ -3,27 +3,60 @@
 
 #include <iostream>
 #include <cstring>
+#include <cstdlib>
 using namespace std;
 
 #include "Shell.h"
 
 int main(int argc, char **argv)
 {
+  // let the shell see typed-ahead input in cin's buffer (write-back timer)
+  ios_base::sync_with_stdio(false);
+
   Shell shell;
 
-  if (argc == 2) {
-    shell.mountNFS(string(argv[1]));
+  // options: -s <script-name>, -w <window> (scripts only), -b <bytes>,
+  // -p <connections>
+  char *script = NULL;
+  bool window_set = false;
+  bool valid = true;
+  int i = 1;
+  for (; i + 1 < argc && argv[i][0] == '-'; i += 2) {
+    if (strcmp(argv[i], "-s") == 0) {
+      script = argv[i + 1];
+    } else if (strcmp(argv[i], "-w") == 0) {
+      shell.set_pipeline_window(atoi(argv[i + 1]));
+      window_set = true;
+    } else if (strcmp(argv[i], "-b") == 0) {
+      shell.set_write_back(strtoul(argv[i + 1], NULL, 0));
+    } else if (strcmp(argv[i], "-p") == 0) {
+      shell.set_transfer_streams(atoi(argv[i + 1]));
+    } else {
+      valid = false;
+    }
+  }
+  if (i != argc - 1 || (window_set && script == NULL)) {
+    valid = false;
+  }
+
+  if (valid && script == NULL) {
+    shell.mountNFS(string(argv[i]));
     shell.run();
   }
-  else if (argc == 4 && strcmp(argv[1], "-s") == 0) {
-    shell.mountNFS(string(argv[3]));
-    shell.run_script(argv[2]);
+  else if (valid) {
+    shell.mountNFS(string(argv[i]));
+    shell.run_script(script);
   }
   else {
     cerr << "Invalid command line" << endl;
     cerr << "Usage (one of the following): " << endl;
     cerr << "./nfsclient server:port" << endl;
     cerr << "./nfsclient -s <script-name> server:port" << endl;
+    cerr << "./nfsclient -s <script-name> -w <window> server:port" << endl;
+    cerr << "(server:port may also be unix:/socket/path, shm:name or local:disk_file)" << endl;
+    cerr << "(a server location may end in @volume to mount one of the server's volumes)" << endl;
+    cerr << "(-b <bytes> buffers appends to a file, up to bytes, into one request)" << endl;
+    cerr << "(-p <connections> spreads put and get over up to that many connections)" << endl;
   }
 
   return 0;
@@ -0,0 +1,388 @@
+// CPSC 3500: microbench
+// Component benchmarks for Disk, BasicFileSys and FileSys, run directly
+// against a scratch disk file with no network in between. Built with
+// optimization by "make bench", which also keeps the results.
+
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <algorithm>
+#include <functional>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <unistd.h>
+
+#include "Disk.h"
+#include "BasicFileSys.h"
+#include "FileSys.h"
+#include "Blocks.h"
+using namespace std;
+
+typedef chrono::steady_clock Clock;
+
+// Result of one benchmark: per-iteration times in nanoseconds
+struct Result {
+    string name;
+    vector<double> ns;
+};
+
+static vector<Result> results;
+
+// Device emulated by every disk under test (-d)
+static DiskModel disk_model;
+
+// Files the disks under test are striped over, and blocks per unit (-S)
+static int stripe_files = 1;
+static int stripe_blocks = Disk::DEFAULT_STRIPE_BLOCKS;
+
+// Mirrors of the disks under test (-M)
+static int mirror_count = 1;
+
+// File i of the scratch disk disk_file: the file itself, then
+// disk_file.1, disk_file.2...
+static string disk_part(const string &disk_file, int i) {
+    return i == 0 ? disk_file : disk_file + "." + to_string(i);
+}
+
+// Layout of the scratch disk disk_file, striped and mirrored as asked
+static string disk_layout(const string &disk_file) {
+    string layout;
+    for (int m = 0; m < mirror_count; m++) {
+        for (int i = 0; i < stripe_files; i++) {
+            layout += (i > 0 ? "," : m > 0 ? "+" : "") + disk_part(disk_file, m * stripe_files + i);
+        }
+    }
+    return layout + ":" + to_string(stripe_blocks);
+}
+
+// Deletes every file of the scratch disk disk_file
+static void remove_disk(const string &disk_file) {
+    for (int i = 0; i < mirror_count * stripe_files; i++) {
+        unlink(disk_part(disk_file, i).c_str());
+    }
+}
+
+// Returns the p-th percentile (0-100) of sorted values, by nearest rank.
+static double percentile(const vector<double> &sorted, double p) {
+    if (sorted.empty()) {
+        return 0;
+    }
+    size_t rank = (size_t) (p / 100 * sorted.size() + 0.999999);
+    rank = max((size_t) 1, min(rank, sorted.size()));
+    return sorted[rank - 1];
+}
+
+// Runs body iterations times, timing each run; setup and teardown run
+// around every iteration outside the measurement.
+static void bench(const string &name, int iterations, const function<void()> &body,
+                  const function<void()> &setup = function<void()>(),
+                  const function<void()> &teardown = function<void()>()) {
+    Result result;
+    result.name = name;
+    result.ns.reserve(iterations);
+    for (int i = 0; i < iterations; i++) {
+        if (setup) {
+            setup();
+        }
+        Clock::time_point start = Clock::now();
+        body();
+        Clock::time_point end = Clock::now();
+        result.ns.push_back(chrono::duration<double, nano>(end - start).count());
+        if (teardown) {
+            teardown();
+        }
+    }
+    sort(result.ns.begin(), result.ns.end());
+    results.push_back(result);
+}
+
+// Fails the run if a file system command did not succeed.
+static void check(const string &status, const char *what) {
+    if (status.compare(0, 3, "200") != 0 && status.compare(0, 3, "206") != 0) {
+        cerr << "Error: " << what << " failed: " << status << endl;
+        exit(-1);
+    }
+}
+
+// Disk: single-block and batched reads and writes, sequential and random
+static void bench_disk(const string &disk_file, int iterations) {
+    Disk disk;
+    disk.mount(disk_layout(disk_file).c_str());
+    disk.set_model(disk_model);
+    datablock_t block;
+    memset(&block, 'd', sizeof(block));
+    for (int b = 0; b < NUM_BLOCKS; b++) {
+        disk.write_block(b, &block);
+    }
+
+    srand(1);
+    vector<int> random_blocks(iterations);
+    for (int i = 0; i < iterations; i++) {
+        random_blocks[i] = rand() % NUM_BLOCKS;
+    }
+    int i = 0;
+    bench("disk.read_block.seq", iterations, [&]() { disk.read_block(i++ % NUM_BLOCKS, &block); });
+    i = 0;
+    bench("disk.read_block.random", iterations, [&]() { disk.read_block(random_blocks[i++], &block); });
+    i = 0;
+    bench("disk.write_block.seq", iterations, [&]() { disk.write_block(i++ % NUM_BLOCKS, &block); });
+    i = 0;
+    bench("disk.write_block.random", iterations, [&]() { disk.write_block(random_blocks[i++], &block); });
+
+    // a whole file's worth of blocks, consecutive (one system call) and
+    // scattered (one per block)
+    short consecutive[MAX_DATA_BLOCKS], scattered[MAX_DATA_BLOCKS];
+    for (int b = 0; b < MAX_DATA_BLOCKS; b++) {
+        consecutive[b] = 100 + b;
+        scattered[b] = 100 + 2 * b;
+    }
+    vector<datablock_t> blocks(MAX_DATA_BLOCKS);
+    bench("disk.read_blocks.60.consecutive", iterations / 10,
+          [&]() { disk.read_blocks(consecutive, MAX_DATA_BLOCKS, blocks.data()); });
+    bench("disk.read_blocks.60.scattered", iterations / 10,
+          [&]() { disk.read_blocks(scattered, MAX_DATA_BLOCKS, blocks.data()); });
+    bench("disk.write_blocks.60.consecutive", iterations / 10,
+          [&]() { disk.write_blocks(consecutive, MAX_DATA_BLOCKS, blocks.data()); });
+    bench("disk.write_blocks.60.scattered", iterations / 10,
+          [&]() { disk.write_blocks(scattered, MAX_DATA_BLOCKS, blocks.data()); });
+    disk.unmount();
+}
+
+// BasicFileSys: allocating and reclaiming a block, and allocating a run
+// of 8, with the disk filled to various levels. Each allocation is undone
+// by a reclaim, so the fill level holds for the whole run.
+static void bench_allocator(const string &disk_file, int iterations) {
+    static const int fill_percents[] = {0, 50, 90, 99};
+    for (size_t f = 0; f < sizeof(fill_percents) / sizeof(fill_percents[0]); f++) {
+        remove_disk(disk_file);
+        BasicFileSys bfs;
+        bfs.mount(disk_layout(disk_file).c_str());
+        bfs.set_disk_model(disk_model);
+        int target_free = NUM_BLOCKS - NUM_BLOCKS * fill_percents[f] / 100;
+        while (bfs.free_block_count() > max(target_free, 1)) {
+            bfs.get_free_block();
+        }
+
+        string level = to_string(fill_percents[f]);
+        short block = 0;
+        bench("bfs.get_free_block.fill" + level, iterations, [&]() { block = bfs.get_free_block(); },
+              function<void()>(), [&]() { bfs.reclaim_block(block); });
+        bench("bfs.reclaim_block.fill" + level, iterations, [&]() { bfs.reclaim_block(block); },
+              [&]() { block = bfs.get_free_block(); });
+        vector<short> run(8);
+        bench("bfs.get_free_blocks.8.fill" + level, iterations,
+              [&]() { block = bfs.get_free_blocks(8); }, function<void()>(), [&]() {
+                  if (block != 0) {
+                      for (int i = 0; i < 8; i++) {
+                          run[i] = block + i;
+                      }
+                      bfs.reclaim_blocks(run);
+                  }
+              });
+        bfs.unmount();
+    }
+}
+
+// FileSys: every command on a path three directories deep, with the path
+// cache emptied before each command (cold) and left filled (warm)
+static void bench_filesys(const string &disk_file, int iterations) {
+    remove_disk(disk_file);
+    Volume volume;
+    volume.bfs.mount(disk_layout(disk_file).c_str());
+    volume.bfs.set_disk_model(disk_model);
+    FileSys fs(volume);
+    fs.mount(-1);
+
+    check(fs.mkdir("/a"), "mkdir");
+    check(fs.mkdir("/a/b"), "mkdir");
+    check(fs.mkdir("/a/b/c"), "mkdir");
+    check(fs.create("/a/b/c/f"), "create");
+    string kilobyte(1024, 'k');
+    check(fs.append("/a/b/c/f", kilobyte.c_str()), "append");
+    check(fs.create("/a/b/c/g"), "create");
+    string chunk(64, 'a');
+    int g_size = 0; // bytes appended to g
+
+    for (int warm = 0; warm <= 1; warm++) {
+        string suffix = warm ? ".warm" : ".cold";
+        function<void()> prepare = [&]() {
+            fs.clear_response();
+            fs.clear_changes();
+            if (!warm) {
+                volume.path_cache.clear();
+            }
+        };
+        // runs body (a command) after prepare, then undo untimed
+        auto command = [&](const string &name, const function<string()> &body,
+                           const function<void()> &undo) {
+            bench("fs." + name + suffix, iterations, [&]() { check(body(), name.c_str()); },
+                  prepare, [&]() {
+                      if (undo) {
+                          fs.clear_response();
+                          undo();
+                      }
+                  });
+        };
+        function<void()> none;
+
+        command("mkdir", [&]() { return fs.mkdir("/a/b/c/d"); },
+                [&]() { check(fs.rmdir("/a/b/c/d"), "rmdir"); });
+        bench("fs.rmdir" + suffix, iterations, [&]() { check(fs.rmdir("/a/b/c/d"), "rmdir"); },
+              [&]() { check(fs.mkdir("/a/b/c/d"), "mkdir"); prepare(); });
+        command("create", [&]() { return fs.create("/a/b/c/h"); },
+                [&]() { check(fs.rm("/a/b/c/h"), "rm"); });
+        bench("fs.rm" + suffix, iterations, [&]() { check(fs.rm("/a/b/c/h"), "rm"); },
+              [&]() { check(fs.create("/a/b/c/h"), "create"); prepare(); });
+        command("append", [&]() { return fs.append("/a/b/c/g", chunk.c_str()); },
+                [&]() {
+                    // start over before g reaches the maximum file size
+                    g_size += chunk.length();
+                    if (g_size + chunk.length() > MAX_FILE_SIZE) {
+                        check(fs.rm("/a/b/c/g"), "rm");
+                        check(fs.create("/a/b/c/g"), "create");
+                        g_size = 0;
+                    }
+                });
+        command("write", [&]() { return fs.write("/a/b/c/f", 512, chunk.c_str(), chunk.length()); }, none);
+        command("cat", [&]() { return fs.cat("/a/b/c/f"); }, none);
+        command("head", [&]() { return fs.head("/a/b/c/f", 100); }, none);
+        command("read", [&]() { return fs.read("/a/b/c/f", 256, 512); }, none);
+        command("stat", [&]() { return fs.stat("/a/b/c/f"); }, none);
+        command("ls", [&]() { return fs.ls("/a/b/c"); }, none);
+        command("ls_long", [&]() { return fs.ls_long(0, MAX_DIR_ENTRIES, "/a/b/c"); }, none);
+        command("cd", [&]() { return fs.cd("/a/b/c"); }, [&]() { fs.home(); });
+        command("du", [&]() { return fs.du("/a"); }, none);
+    }
+
+    fs.unmount();
+    volume.bfs.unmount();
+}
+
+// Prints the results as a table.
+static void print_table() {
+    printf("Disk model: %s\n", disk_model.describe().c_str());
+    printf("%-34s %8s %10s %10s %10s %10s\n", "benchmark", "iters", "mean ns", "p50 ns", "p99 ns", "max ns");
+    for (size_t r = 0; r < results.size(); r++) {
+        const vector<double> &ns = results[r].ns;
+        double sum = 0;
+        for (size_t i = 0; i < ns.size(); i++) {
+            sum += ns[i];
+        }
+        printf("%-34s %8zu %10.0f %10.0f %10.0f %10.0f\n", results[r].name.c_str(), ns.size(),
+               ns.empty() ? 0 : sum / ns.size(), percentile(ns, 50), percentile(ns, 99),
+               ns.empty() ? 0 : ns.back());
+    }
+}
+
+// Appends the results to file as one JSON object on a line of its own,
+// stamped with the time and label, so runs can be compared over time.
+static bool append_json(const string &file, const string &label) {
+    ofstream out(file.c_str(), ios::app);
+    if (!out) {
+        return false;
+    }
+    out << "{\"time\": " << time(NULL) << ", \"label\": \"" << label << "\", \"disk\": \""
+        << disk_model.describe() << "\", \"results\": {";
+    for (size_t r = 0; r < results.size(); r++) {
+        const vector<double> &ns = results[r].ns;
+        double sum = 0;
+        for (size_t i = 0; i < ns.size(); i++) {
+            sum += ns[i];
+        }
+        out << (r ? ", " : "") << "\"" << results[r].name << "\": {\"iters\": " << ns.size()
+            << ", \"mean_ns\": " << (ns.empty() ? 0 : sum / ns.size())
+            << ", \"p50_ns\": " << percentile(ns, 50) << ", \"p99_ns\": " << percentile(ns, 99) << "}";
+    }
+    out << "}}" << endl;
+    return true;
+}
+
+static void usage() {
+    cerr << "Usage: ./microbench [-n iterations] [-o results.jsonl] [-l label] [-d model]" << endl;
+    cerr << "                    [-S files[:stripe_blocks]] [-M mirrors]" << endl;
+    cerr << "  -n  iterations per benchmark (default 2000)" << endl;
+    cerr << "  -o  append the results as a JSON line to this file" << endl;
+    cerr << "  -l  label stored with the results (e.g. a commit id)" << endl;
+    cerr << "  -d  emulated device: none, ssd or hdd[,key=value...] (see DiskModel.h)" << endl;
+    cerr << "  -S  stripe the scratch disk over this many files, each a device" << endl;
+    cerr << "  -M  mirror the scratch disk this many times" << endl;
+}
+
+int main(int argc, char **argv) {
+    int iterations = 2000;
+    string json_file, label;
+    for (int i = 1; i < argc; i += 2) {
+        string flag = argv[i];
+        if (i + 1 >= argc) {
+            usage();
+            return -1;
+        } else if (flag == "-n") {
+            iterations = atoi(argv[i + 1]);
+        } else if (flag == "-o") {
+            json_file = argv[i + 1];
+        } else if (flag == "-l") {
+            label = argv[i + 1];
+        } else if (flag == "-d") {
+            string error;
+            if (!DiskModel::parse(argv[i + 1], disk_model, error)) {
+                cerr << "Error: " << error << endl;
+                return -1;
+            }
+        } else if (flag == "-S") {
+            char *end;
+            stripe_files = strtol(argv[i + 1], &end, 10);
+            if (*end == ':') {
+                stripe_blocks = strtol(end + 1, &end, 10);
+            }
+            if (*end != '\0' || stripe_files < 1) {
+                usage();
+                return -1;
+            }
+        } else if (flag == "-M") {
+            mirror_count = atoi(argv[i + 1]);
+            if (mirror_count < 1) {
+                usage();
+                return -1;
+            }
+        } else {
+            usage();
+            return -1;
+        }
+    }
+    if (iterations < 10) {
+        usage();
+        return -1;
+    }
+    vector<vector<string> > mirrors;
+    string error;
+    if (!Disk::parse_layout(disk_layout("scratch"), mirrors, stripe_blocks, error)) {
+        cerr << "Error: " << error << endl;
+        return -1;
+    }
+
+    // A scratch disk, never the DISK of the server
+    char disk_file[] = "/tmp/microbench.XXXXXX";
+    int fd = mkstemp(disk_file);
+    if (fd == -1) {
+        cerr << "Error: cannot create a scratch disk" << endl;
+        return -1;
+    }
+    close(fd);
+    unlink(disk_file);
+
+    bench_disk(disk_file, iterations);
+    bench_allocator(disk_file, iterations);
+    bench_filesys(disk_file, iterations);
+    remove_disk(disk_file);
+
+    print_table();
+    if (!json_file.empty() && !append_json(json_file, label)) {
+        cerr << "Error: cannot write " << json_file << endl;
+        return -1;
+    }
+    return 0;
+}
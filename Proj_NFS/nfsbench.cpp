@@ -0,0 +1,414 @@
+// CPSC 3500: nfsbench
+// Load generator for the NFS server. Opens several connections at once,
+// each running a closed loop of requests from one operation mix, and
+// reports throughput and latency percentiles per operation.
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <map>
+#include <thread>
+#include <chrono>
+#include <algorithm>
+#include <cstring>
+#include <cstdlib>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netdb.h>
+
+#include "Channel.h"
+#include "Blocks.h"
+using namespace std;
+
+typedef chrono::steady_clock Clock;
+
+static const int MAX_CONNECTIONS = 64; // 8 groups of 8 directories, see connection_dir
+
+// Benchmark settings, from the command line
+struct Options {
+    string location;        // server:port or unix:/socket/path
+    int connections = 4;    // concurrent connections
+    int ops = 1000;         // requests per connection
+    string mix = "meta";    // meta, append or cat
+    int think_ms = 0;       // pause after each request
+    int data_size = 64;     // bytes per append; file size for cat
+    string json_file;       // where to write the JSON report, "-" for stdout
+};
+
+// Latencies (microseconds) and errors of one kind of request
+struct OpStats {
+    vector<double> latencies_us;
+    long errors = 0;
+};
+
+// One connection to the server
+struct Connection {
+    Channel *channel = NULL;
+    string buffer;          // received bytes past the last response
+    map<string, OpStats> stats;
+};
+
+// Connects a stream socket to location, unix:/socket/path or server:port.
+// Returns the socket, or -1 (with the reason on cerr) on failure.
+static int connect_socket(const string &location) {
+    if (location.compare(0, 5, "unix:") == 0) {
+        struct sockaddr_un address;
+        memset(&address, 0, sizeof(address));
+        address.sun_family = AF_UNIX;
+        string path = location.substr(5);
+        if (path.empty() || path.length() >= sizeof(address.sun_path)) {
+            cerr << "Error: Invalid unix socket path: " << path << endl;
+            return -1;
+        }
+        strcpy(address.sun_path, path.c_str());
+        int sock = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (sock < 0 || connect(sock, (struct sockaddr *) &address, sizeof(address)) < 0) {
+            cerr << "Error connecting to server: " << strerror(errno) << endl;
+            if (sock >= 0) {
+                close(sock);
+            }
+            return -1;
+        }
+        return sock;
+    }
+
+    size_t colon = location.find(':');
+    if (colon == string::npos) {
+        cerr << "Error: Invalid server:port format. Expected server:port" << endl;
+        return -1;
+    }
+    struct hostent *server = gethostbyname(location.substr(0, colon).c_str());
+    if (server == NULL) {
+        cerr << "Error: No such host: " << location.substr(0, colon) << endl;
+        return -1;
+    }
+    struct sockaddr_in address;
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    memcpy(&address.sin_addr.s_addr, server->h_addr, server->h_length);
+    address.sin_port = htons(atoi(location.substr(colon + 1).c_str()));
+    int sock = socket(AF_INET, SOCK_STREAM, 0);
+    if (sock < 0 || connect(sock, (struct sockaddr *) &address, sizeof(address)) < 0) {
+        cerr << "Error connecting to server: " << strerror(errno) << endl;
+        if (sock >= 0) {
+            close(sock);
+        }
+        return -1;
+    }
+    return sock;
+}
+
+// Receives one response and returns its status code, or -1 if the
+// connection failed. The body is skipped.
+static int receive_status(Connection &conn) {
+    size_t header_end;
+    while ((header_end = conn.buffer.find("\r\n\r\n")) == string::npos) {
+        char temp[65536];
+        ssize_t n = conn.channel->recv(temp, sizeof(temp));
+        if (n <= 0) {
+            return -1;
+        }
+        conn.buffer.append(temp, n);
+    }
+    int status = atoi(conn.buffer.c_str());
+    size_t length_pos = conn.buffer.find("Length:");
+    size_t body_length = (length_pos < header_end) ? strtoul(conn.buffer.c_str() + length_pos + 7, NULL, 10) : 0;
+
+    // drop the header and as much of the body as is buffered, then the rest
+    size_t end = header_end + 4 + body_length;
+    if (conn.buffer.length() >= end) {
+        conn.buffer.erase(0, end);
+        return status;
+    }
+    size_t missing = end - conn.buffer.length();
+    conn.buffer.clear();
+    while (missing > 0) {
+        char temp[65536];
+        ssize_t n = conn.channel->recv(temp, min(missing, sizeof(temp)));
+        if (n <= 0) {
+            return -1;
+        }
+        missing -= n;
+    }
+    return status;
+}
+
+// Sends request and waits for its response, recording the latency under
+// op. Returns the status code, or -1 if the connection failed.
+static int timed_request(Connection &conn, const string &op, const string &request) {
+    string line = request + "\r\n";
+    Clock::time_point start = Clock::now();
+    if (conn.channel->send_all(line.data(), line.length()) == -1) {
+        return -1;
+    }
+    int status = receive_status(conn);
+    Clock::time_point end = Clock::now();
+    if (status == -1) {
+        return -1;
+    }
+    OpStats &stats = conn.stats[op];
+    stats.latencies_us.push_back(chrono::duration<double, micro>(end - start).count());
+    if (status != 200) {
+        stats.errors++;
+    }
+    return status;
+}
+
+// Sends request outside of the measurements (setup and clean-up).
+// Returns the status code, or -1 if the connection failed.
+static int untimed_request(Connection &conn, const string &request) {
+    string line = request + "\r\n";
+    if (conn.channel->send_all(line.data(), line.length()) == -1) {
+        return -1;
+    }
+    return receive_status(conn);
+}
+
+// Directory of connection i below base. A directory holds at most
+// MAX_DIR_ENTRIES entries, so connections are spread over groups of 8.
+static string connection_dir(const string &base, int i) {
+    return base + "/g" + to_string(i / 8) + "/c" + to_string(i % 8);
+}
+
+// Runs opts.ops requests of the mix on conn, in its own directory dir.
+static void run_connection(const Options &opts, Connection &conn, const string &dir,
+                           bool &failed) {
+    if (untimed_request(conn, "cd " + dir) != 200) {
+        failed = true;
+        return;
+    }
+    string data(opts.data_size, 'x');
+    if (opts.mix == "cat") {
+        // one file of data_size bytes, read over and over
+        if (untimed_request(conn, "create f") != 200 ||
+            (!data.empty() && untimed_request(conn, "append f " + data) != 200)) {
+            failed = true;
+            return;
+        }
+    } else if (opts.mix == "append") {
+        if (untimed_request(conn, "create f") != 200) {
+            failed = true;
+            return;
+        }
+    }
+
+    int file_size = 0;   // append mix: bytes in f
+    int step = 0;        // meta mix: position in mkdir, create, rm, rmdir
+    for (int i = 0; i < opts.ops; i++) {
+        int status;
+        if (opts.mix == "meta") {
+            // a directory with one file in it, made and removed again
+            static const char *ops[] = {"mkdir", "create", "rm", "rmdir"};
+            static const char *args[] = {"d", "d/f", "d/f", "d"};
+            status = timed_request(conn, ops[step], string(ops[step]) + " " + args[step]);
+            step = (step + 1) % 4;
+        } else if (opts.mix == "append") {
+            if (file_size + opts.data_size > MAX_FILE_SIZE) {
+                // start over with an empty file once f is full
+                status = timed_request(conn, "rm", "rm f");
+                if (status != -1) {
+                    status = timed_request(conn, "create", "create f");
+                }
+                file_size = 0;
+            } else {
+                status = timed_request(conn, "append", "append f " + data);
+                file_size += opts.data_size;
+            }
+        } else {
+            status = timed_request(conn, "cat", "cat f");
+        }
+        if (status == -1) {
+            failed = true;
+            return;
+        }
+        if (opts.think_ms > 0) {
+            this_thread::sleep_for(chrono::milliseconds(opts.think_ms));
+        }
+    }
+}
+
+// Returns the p-th percentile (0-100) of sorted values, by nearest rank.
+static double percentile(const vector<double> &sorted, double p) {
+    if (sorted.empty()) {
+        return 0;
+    }
+    size_t rank = (size_t) (p / 100 * sorted.size() + 0.999999);
+    rank = max((size_t) 1, min(rank, sorted.size()));
+    return sorted[rank - 1];
+}
+
+// Writes the report for stats, gathered over seconds, as JSON.
+static void write_json(ostream &out, const Options &opts, double seconds,
+                       map<string, OpStats> &stats) {
+    long total = 0;
+    for (map<string, OpStats>::iterator it = stats.begin(); it != stats.end(); it++) {
+        total += it->second.latencies_us.size();
+    }
+    out << "{\n";
+    out << "  \"mix\": \"" << opts.mix << "\",\n";
+    out << "  \"connections\": " << opts.connections << ",\n";
+    out << "  \"ops_per_connection\": " << opts.ops << ",\n";
+    out << "  \"think_ms\": " << opts.think_ms << ",\n";
+    out << "  \"data_size\": " << opts.data_size << ",\n";
+    out << "  \"elapsed_s\": " << seconds << ",\n";
+    out << "  \"throughput_ops_s\": " << total / seconds << ",\n";
+    out << "  \"ops\": {";
+    const char *separator = "\n";
+    for (map<string, OpStats>::iterator it = stats.begin(); it != stats.end(); it++) {
+        vector<double> &lat = it->second.latencies_us;
+        out << separator << "    \"" << it->first << "\": {"
+            << "\"count\": " << lat.size()
+            << ", \"errors\": " << it->second.errors
+            << ", \"ops_s\": " << lat.size() / seconds
+            << ", \"p50_us\": " << percentile(lat, 50)
+            << ", \"p95_us\": " << percentile(lat, 95)
+            << ", \"p99_us\": " << percentile(lat, 99)
+            << ", \"p999_us\": " << percentile(lat, 99.9) << "}";
+        separator = ",\n";
+    }
+    out << "\n  }\n}\n";
+}
+
+// Prints the report for stats, gathered over seconds, as a table.
+static void print_table(const Options &opts, double seconds, map<string, OpStats> &stats) {
+    long total = 0;
+    for (map<string, OpStats>::iterator it = stats.begin(); it != stats.end(); it++) {
+        total += it->second.latencies_us.size();
+    }
+    cout << "mix " << opts.mix << ", " << opts.connections << " connections, "
+         << total << " requests in " << seconds << " s: " << total / seconds << " ops/s" << endl;
+    cout << "op        count  errors     ops/s   p50 us   p95 us   p99 us  p999 us" << endl;
+    for (map<string, OpStats>::iterator it = stats.begin(); it != stats.end(); it++) {
+        vector<double> &lat = it->second.latencies_us;
+        char line[200];
+        snprintf(line, sizeof(line), "%-8s %6zu %7ld %9.0f %8.1f %8.1f %8.1f %8.1f",
+                 it->first.c_str(), lat.size(), it->second.errors, lat.size() / seconds,
+                 percentile(lat, 50), percentile(lat, 95), percentile(lat, 99),
+                 percentile(lat, 99.9));
+        cout << line << endl;
+    }
+}
+
+static void usage() {
+    cerr << "Usage: ./nfsbench [-c connections] [-n ops] [-m meta|append|cat] [-t think_ms]" << endl;
+    cerr << "                  [-s bytes] [-j report.json|-] server:port|unix:/socket/path" << endl;
+    cerr << "  -c  concurrent connections (default 4, at most " << MAX_CONNECTIONS << ")" << endl;
+    cerr << "  -n  requests per connection (default 1000)" << endl;
+    cerr << "  -m  mix: meta (mkdir, create, rm, rmdir), append or cat (default meta)" << endl;
+    cerr << "  -t  pause in ms after each request (default 0)" << endl;
+    cerr << "  -s  bytes per append, or size of the file read by cat (default 64)" << endl;
+    cerr << "  -j  write the report as JSON to a file, or to stdout with -" << endl;
+}
+
+int main(int argc, char **argv) {
+    Options opts;
+    int i = 1;
+    for (; i + 1 < argc && argv[i][0] == '-'; i += 2) {
+        string flag = argv[i];
+        if (flag == "-c") {
+            opts.connections = atoi(argv[i + 1]);
+        } else if (flag == "-n") {
+            opts.ops = atoi(argv[i + 1]);
+        } else if (flag == "-m") {
+            opts.mix = argv[i + 1];
+        } else if (flag == "-t") {
+            opts.think_ms = atoi(argv[i + 1]);
+        } else if (flag == "-s") {
+            opts.data_size = atoi(argv[i + 1]);
+        } else if (flag == "-j") {
+            opts.json_file = argv[i + 1];
+        } else {
+            usage();
+            return -1;
+        }
+    }
+    if (i != argc - 1 || opts.connections < 1 || opts.connections > MAX_CONNECTIONS ||
+        opts.ops < 0 || opts.data_size < 0 || opts.data_size > MAX_FILE_SIZE ||
+        (opts.mix != "meta" && opts.mix != "append" && opts.mix != "cat") ||
+        (opts.mix == "append" && opts.data_size == 0)) {
+        usage();
+        return -1;
+    }
+    opts.location = argv[i];
+
+    // Open every connection before the clock starts
+    vector<Connection> conns(opts.connections);
+    for (int c = 0; c < opts.connections; c++) {
+        int sock = connect_socket(opts.location);
+        if (sock < 0) {
+            return -1;
+        }
+        conns[c].channel = new SocketChannel(sock);
+    }
+
+    // A fresh directory tree for this run: base/g<n>/c<n>, one leaf per
+    // connection
+    string base = "/nb" + to_string(getpid() % 100000);
+    bool setup_ok = untimed_request(conns[0], "mkdir " + base) == 200;
+    for (int c = 0; setup_ok && c < opts.connections; c++) {
+        if (c % 8 == 0) {
+            setup_ok = untimed_request(conns[0], "mkdir " + base + "/g" + to_string(c / 8)) == 200;
+        }
+        setup_ok = setup_ok && untimed_request(conns[0], "mkdir " + connection_dir(base, c)) == 200;
+    }
+    if (!setup_ok) {
+        cerr << "Error: could not create the benchmark directories below " << base << endl;
+        return -1;
+    }
+
+    vector<char> failed(opts.connections, false);
+    Clock::time_point start = Clock::now();
+    vector<thread> workers;
+    for (int c = 0; c < opts.connections; c++) {
+        workers.push_back(thread([&opts, &conns, &failed, &base, c]() {
+            bool conn_failed = false;
+            run_connection(opts, conns[c], connection_dir(base, c), conn_failed);
+            failed[c] = conn_failed;
+        }));
+    }
+    for (size_t w = 0; w < workers.size(); w++) {
+        workers[w].join();
+    }
+    double seconds = chrono::duration<double>(Clock::now() - start).count();
+
+    // Clean up and merge the measurements of all connections
+    untimed_request(conns[0], "home");
+    untimed_request(conns[0], "rm -r " + base);
+    map<string, OpStats> stats;
+    for (int c = 0; c < opts.connections; c++) {
+        if (failed[c]) {
+            cerr << "Warning: connection " << c << " failed before finishing" << endl;
+        }
+        for (map<string, OpStats>::iterator it = conns[c].stats.begin(); it != conns[c].stats.end(); it++) {
+            OpStats &merged = stats[it->first];
+            merged.latencies_us.insert(merged.latencies_us.end(), it->second.latencies_us.begin(),
+                                       it->second.latencies_us.end());
+            merged.errors += it->second.errors;
+        }
+        conns[c].channel->close();
+        delete conns[c].channel;
+    }
+    for (map<string, OpStats>::iterator it = stats.begin(); it != stats.end(); it++) {
+        sort(it->second.latencies_us.begin(), it->second.latencies_us.end());
+    }
+
+    if (opts.json_file == "-") {
+        write_json(cout, opts, seconds, stats);
+    } else {
+        print_table(opts, seconds, stats);
+        if (!opts.json_file.empty()) {
+            ofstream out(opts.json_file.c_str());
+            if (!out) {
+                cerr << "Error: cannot write " << opts.json_file << endl;
+                return -1;
+            }
+            write_json(out, opts, seconds, stats);
+        }
+    }
+    return 0;
+}
@@ -4,224 +4,490 @@
 #include <cstdlib>
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/uio.h>    // For struct iovec
 #include <netinet/in.h>
 #include <netdb.h>
 #include <unistd.h>     // For close()
 #include <cstring>      // For memset, strerror
 #include <sstream>      // For stringstream parsing
+#include <map>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <chrono>
 
 #include "FileSys.h"
+#include "Channel.h"
+#include "Dispatch.h"
+#include "Lease.h"
+#include "Logger.h"
+#include "Trace.h"
 using namespace std;
 
-// Helper function to send all data in a buffer (handles partial sends)
-ssize_t send_all(int sockfd, const char *buf, size_t len) {
-    size_t total = 0; // how many bytes we've sent
-    size_t bytesleft = len; // how many we have left to send
-    ssize_t n;
-
-    while(total < len) {
-        n = send(sockfd, buf + total, bytesleft, 0);
-        if (n == -1) { break; }
-        total += n;
-        bytesleft -= n;
-    }
-    return n == -1 ? -1 : total; // return -1 on failure, total bytes sent on success
-}
-
-// Helper function to receive data until \r\n (for client commands)
-// This implementation is more robust for commands.
-string receive_client_command(int sockfd) {
-    string received_line;
-    char c;
+// How long a client may cache an ls, stat, cat or head result
+static const int LEASE_MS = 5000;
+
+// One request in this many is logged at the info level (all of them at
+// debug)
+static const int DEFAULT_SAMPLE_EVERY = 100;
+
+// Where traces of slow requests go (with -t)
+static const char *SLOW_TRACE_FILE = "slow_traces.json";
+
+// Volume exported when none is named with -v
+static const char *DEFAULT_VOLUME = "default";
+static const char *DEFAULT_DISK = "DISK";
+
+struct Session;
+
+// A volume the server exports, with the sessions working on it
+struct Export {
+    string name;                    // what clients call it
+    string disk_path;               // its disk file, or files if striped or mirrored
+    Volume volume;                  // the disk, shared by every session on it
+    LeaseTable lease_table;         // guarded by volume.lock
+    map<int, Session *> sessions;   // guarded by volume.lock
+};
+
+// One client connection
+struct Session {
+    int id;
+    Channel *channel;
+    Export *exp;                    // the volume the client works on
+    unique_ptr<FileSys> fs;         // session on exp->volume
+    RequestReader reader;
+    mutex send_lock;    // one message at a time on channel
+    mutex outbox_lock;  // guards outbox
+    string outbox;      // invalidations not sent yet, the first maybe in part
+    bool leases;        // true if the client caches results under leases
+    Trace trace;        // spans of the running request, when tracing
+
+    Session(int id, Channel *channel)
+        : id(id), channel(channel), exp(NULL), reader(channel), leases(false) {}
+};
+
+static vector<Export *> exports;    // the first one is where sessions start
+static Logger logger;               // server log, written out by a background thread
+static long long slow_trace_ns = -1; // requests taking this long are traced, -1 for none
+static TraceWriter slow_traces;     // traces of slow requests
+
+// Prints the metrics of every volume every interval_s seconds
+static void dump_stats(int interval_s) {
     while (true) {
-        ssize_t bytes_read = recv(sockfd, &c, 1, 0);
-        if (bytes_read <= 0) { // Connection closed or error
-            if (bytes_read == 0) {
-                cout << "Client disconnected." << endl;
-            } else {
-                cerr << "Error receiving data from client: " << strerror(errno) << endl;
+        this_thread::sleep_for(chrono::seconds(interval_s));
+        for (size_t i = 0; i < exports.size(); i++) {
+            string report;
+            {
+                lock_guard<mutex> guard(exports[i]->volume.lock);
+                report = exports[i]->volume.report();
             }
-            return ""; // Signal end of connection or error
-        }
-        received_line += c;
-        // Check for end of line marker
-        if (received_line.length() >= 2 &&
-            received_line[received_line.length() - 2] == '\r' &&
-            received_line[received_line.length() - 1] == '\n') {
-            break; // Found the delimiter
+            logger.log(LOG_INFO, "Stats of volume " + exports[i]->name + ":\n" +
+                                 report.substr(0, report.length() - 1));
         }
     }
-    // Remove the \r\n from the end of the command
-    return received_line.substr(0, received_line.length() - 2);
 }
 
+// Starts session on exp: a new FileSys at the root of exp's volume
+static void attach_session(Session &session, Export *exp) {
+    lock_guard<mutex> guard(exp->volume.lock);
+    session.exp = exp;
+    session.fs.reset(new FileSys(exp->volume));
+    session.fs->mount(-1); // the channel is closed by serve_client
+    // File data is read into the response while the volume is locked, not
+    // left on the disk for sendfile: the response goes out after the lock
+    // is released, so another session may change those blocks meanwhile
+    session.fs->set_zero_copy(false);
+    exp->sessions[session.id] = &session;
+}
 
-int main(int argc, char* argv[]) {
-    if (argc < 2) {
-        cout << "Usage: ./nfsserver port#\n";
-        return -1;
-    }
-    int port = atoi(argv[1]);
-
-    int listen_sock; // Socket for listening for new connections
-    int comm_sock;   // Socket for communication with an accepted client
+// Ends session's work on its volume, dropping its leases there
+static void detach_session(Session &session) {
+    Export *exp = session.exp;
+    lock_guard<mutex> guard(exp->volume.lock);
+    exp->sessions.erase(session.id);
+    exp->lease_table.release(session.id);
+    session.fs->unmount();
+    session.fs.reset();
+    session.exp = NULL;
+}
 
-    listen_sock = socket(AF_INET, SOCK_STREAM, 0);
-    if (listen_sock < 0) {
-        cerr << "Error creating socket" << endl;
-        return -1;
+// Runs "volume [name]": moves session to the volume called name, at its
+// root. Returns the status line.
+static string switch_volume(Session &session, const string &name) {
+    if (name.empty() || name == session.exp->name) {
+        return "200 OK";
     }
-
-    int optval = 1;
-    setsockopt(listen_sock, SOL_SOCKET, SO_REUSEADDR, (const void *)&optval , sizeof(int));
-
-    struct sockaddr_in server_address;
-    memset((char *) &server_address, 0, sizeof(server_address));
-    server_address.sin_family = AF_INET;
-    server_address.sin_addr.s_addr = INADDR_ANY;
-    server_address.sin_port = htons(port);
-
-    if (bind(listen_sock, (struct sockaddr *) &server_address, sizeof(server_address)) < 0) {
-        cerr << "Error binding socket" << endl;
-        close(listen_sock);
-        return -1;
+    for (size_t i = 0; i < exports.size(); i++) {
+        if (exports[i]->name == name) {
+            detach_session(session);
+            attach_session(session, exports[i]);
+            return "200 OK";
+        }
     }
+    return "511 No such volume";
+}
 
-    if (listen(listen_sock, 5) < 0) {
-        cerr << "Error listening on socket" << endl;
-        close(listen_sock);
-        return -1;
+// Lists the exported volumes, "name disk_path" per line, with the one
+// session works on marked by a leading "*"
+static string volume_list(Session &session) {
+    string body;
+    for (size_t i = 0; i < exports.size(); i++) {
+        body += (exports[i] == session.exp ? "* " : "  ") + exports[i]->name + " " +
+                exports[i]->disk_path + (i + 1 < exports.size() ? "\n" : "");
     }
+    return body;
+}
 
-    cout << "NFS Server listening on port " << port << "..." << endl;
+// Sends session's outbox, waiting for the client to read it if wait is
+// set, else only as much as goes without waiting; the rest stays queued.
+// The caller holds session's send_lock. A failed send shows up on the
+// session's own next send.
+static void flush_outbox(Session &session, bool wait) {
+    string pending;
+    {
+        lock_guard<mutex> outbox_guard(session.outbox_lock);
+        pending.swap(session.outbox);
+    }
+    if (pending.empty()) {
+        return;
+    }
+    ssize_t sent = wait ? session.channel->send_all(pending.data(), pending.length())
+                        : session.channel->try_send(pending.data(), pending.length());
+    if (sent >= 0 && (size_t) sent < pending.length()) {
+        lock_guard<mutex> outbox_guard(session.outbox_lock);
+        session.outbox.insert(0, pending, sent, string::npos);
+    }
+}
 
-    struct sockaddr_in client_address;
-    socklen_t client_len = sizeof(client_address);
-    comm_sock = accept(listen_sock, (struct sockaddr *) &client_address, &client_len);
-    if (comm_sock < 0) {
-        cerr << "Error accepting client connection" << endl;
-        close(listen_sock);
-        return -1;
+// Queues a "150 Invalidate" message for session, listing one path per
+// line, telling it to drop its cached results for paths.
+static void queue_invalidation(Session &session, const vector<string> &paths) {
+    string body;
+    for (size_t i = 0; i < paths.size(); i++) {
+        body += paths[i] + "\n";
     }
+    lock_guard<mutex> outbox_guard(session.outbox_lock);
+    session.outbox += response_header("150 Invalidate", body.length()) + body;
+}
 
-    cout << "Client connected. New communication socket: " << comm_sock << endl;
+// Sends session's queued invalidations as far as they go without waiting,
+// unless its own thread is sending, which sends them once it is done. A
+// client that stops reading thus holds up no other session, even while
+// the volume is locked; what it has not read waits for its next response.
+static void try_flush_outbox(Session &session) {
+    unique_lock<mutex> send_guard(session.send_lock, try_to_lock);
+    if (send_guard.owns_lock()) {
+        flush_outbox(session, false);
+    }
+}
 
-    FileSys fs;
-    fs.mount(comm_sock);
+// Runs the requests of one client until it disconnects. Each request runs
+// with the lock of the client's volume held, so sessions see each other's
+// changes whole.
+static void serve_client(Channel *channel, int id) {
+    Session session(id, channel);
+    session.reader.logger = &logger;
+    attach_session(session, exports[0]);
 
-    cout << "File system mounted. Server waiting for commands." << endl;
+    logger.log(LOG_INFO, "Client " + to_string(id) + " connected. Server waiting for commands.");
 
+    size_t bytes_sent = 0;      // response bytes sent to the client
+    size_t zero_copy_bytes = 0; // stays 0, zero copy is off
     string client_request_line;
     while (true) {
-        client_request_line = receive_client_command(comm_sock);
+        client_request_line = receive_client_command(session.reader);
 
         if (client_request_line.empty()) { // Client disconnected or error
             break;
         }
 
-        cout << "Received command: [" << client_request_line << "]" << endl;
-
-        // Parse command and its arguments
-        stringstream ss(client_request_line);
-        string command_name;
-        string arg1, arg2;
-
-        ss >> command_name;
-        ss >> arg1;
-        ss >> arg2;
-
-        string fs_raw_response; // This will hold the "Status_code Status_message\nbody_content" from FileSys
-
-        // --- Command Processing and FileSys Invocation ---
-        if (command_name == "ls") {
-            fs_raw_response = fs.ls();
-        } else if (command_name == "mkdir") {
-            fs_raw_response = fs.mkdir(arg1.c_str());
-        } else if (command_name == "cd") {
-            fs_raw_response = fs.cd(arg1.c_str());
-        } else if (command_name == "home") {
-            fs_raw_response = fs.home();
-        } else if (command_name == "rmdir") {
-            fs_raw_response = fs.rmdir(arg1.c_str());
-        } else if (command_name == "create") {
-            fs_raw_response = fs.create(arg1.c_str());
-        } else if (command_name == "append") {
-            // Reconstruct data as it might contain spaces in the assignment's format,
-            // though the example shows no spaces in 'data' itself.
-            // If data can have spaces, it should be passed as a single argument
-            // or encoded. For now, assume arg2 is the full data, or append subsequent words.
-            string data_to_append = arg2;
-            string temp_arg;
-            while (ss >> temp_arg) { // This loop handles if data_to_append has multiple space-separated words
-                data_to_append += " " + temp_arg;
+        // Trace the request from here until its response is sent
+        if (slow_trace_ns >= 0) {
+            session.trace.begin(client_request_line);
+            set_current_trace(&session.trace);
+        }
+
+        // The rest of a batch, or the data of a write, arrives before the
+        // volume is locked
+        string rejection;
+        {
+            TraceScope span("receive request data");
+            if (!buffer_request_data(session.reader, client_request_line, rejection)) {
+                break;
             }
-            fs_raw_response = fs.append(arg1.c_str(), data_to_append.c_str());
-        } else if (command_name == "cat") {
-            fs_raw_response = fs.cat(arg1.c_str());
-        } else if (command_name == "head") {
-            try {
-                unsigned int n = stoul(arg2);
-                fs_raw_response = fs.head(arg1.c_str(), n);
-            } catch (const std::exception& e) {
-                fs_raw_response = "400 Bad Request\nInvalid number for head N";
+        }
+        if (!rejection.empty()) {
+            // The data of the write is not read, so the next request cannot
+            // be found: answer and close the connection
+            lock_guard<mutex> send_guard(session.send_lock);
+            flush_outbox(session, true);
+            string header = response_header(rejection, 0);
+            if (channel->send_all(header.data(), header.length()) != -1) {
+                bytes_sent += header.length();
             }
-        } else if (command_name == "rm") {
-            fs_raw_response = fs.rm(arg1.c_str());
-        } else if (command_name == "stat") {
-            fs_raw_response = fs.stat(arg1.c_str());
+            logger.log(LOG_INFO, "Client " + to_string(id) + ": [" + client_request_line + "] " +
+                                 rejection);
+            break;
+        }
+
+        // The client may move to another volume before this request runs
+        string fs_raw_response;
+        bool volume_request = client_request_line == "volume" ||
+                              client_request_line.compare(0, 7, "volume ") == 0;
+        if (volume_request) {
+            fs_raw_response = switch_volume(session, client_request_line.substr(min((size_t) 7, client_request_line.length())));
+        }
+        Export &exp = *session.exp;
+
+        unique_lock<mutex> guard(exp.volume.lock, defer_lock);
+        {
+            TraceScope span("wait for volume lock");
+            guard.lock();
+        }
+        if (volume_request) {
+            // the volumes, and which one the client is on
+            session.fs->clear_response();
+            session.fs->clear_changes();
+            session.fs->body() = volume_list(session);
+        } else if (client_request_line == "lease on" || client_request_line == "lease off") {
+            // the client asks for (or stops taking) leases on what it reads
+            session.leases = (client_request_line == "lease on");
+            session.fs->clear_response();
+            session.fs->clear_changes();
+            fs_raw_response = "200 OK";
+        } else {
+            TraceScope span("handle request");
+            bool disconnected = false;
+            fs_raw_response = handle_request(*session.fs, session.reader, client_request_line, disconnected);
+            if (disconnected) {
+                break;
+            }
+        }
+
+        // Let the client cache what it read, and take cached copies of what
+        // changed away from every client (including this one, whose
+        // invalidation is sent ahead of the response)
+        string extra_headers = session.fs->headers();
+        const string &read_path = session.fs->read_path();
+        if (session.leases && !read_path.empty()) {
+            exp.lease_table.grant(read_path, id, LeaseTable::Clock::now() + chrono::milliseconds(LEASE_MS));
+            extra_headers += "Lease:" + to_string(LEASE_MS) + " " + read_path + "\r\n";
         }
-        else {
-            fs_raw_response = "400 Bad Request\nUnknown command";
+        map<int, vector<string> > holders = exp.lease_table.revoke(session.fs->changed_paths());
+        for (map<int, vector<string> >::iterator it = holders.begin(); it != holders.end(); it++) {
+            map<int, Session *>::iterator holder = exp.sessions.find(it->first);
+            if (holder != exp.sessions.end()) {
+                queue_invalidation(*holder->second, it->second);
+                if (holder->second != &session) {
+                    try_flush_outbox(*holder->second);
+                }
+            }
         }
 
+        // The response is whole in memory; sending it may wait for the
+        // client, which must not hold up the volume's other sessions
+        guard.unlock();
+
         // --- Format Server Response ---
-        // The FileSys methods return "Status_code Status_message\nbody_content"
-        // We need to reformat this into the final message format:
-        // "Status_code Status_message\r\nLength:size_in_bytes\r\n\r\n<message_body>"
+        size_t body_length = session.fs->body_length();
+        string header = response_header(fs_raw_response, body_length, extra_headers);
 
-        stringstream fs_response_ss(fs_raw_response);
-        string status_line_from_fs;
-        string body_from_fs;
+        // For debugging server-side: the whole response
+        if (logger.enabled(LOG_TRACE)) {
+            logger.log(LOG_TRACE, "Response to client " + to_string(id) + ":\n" + header +
+                                  session.fs->body() + "END_RESPONSE_DELIMITER");
+        }
 
-        getline(fs_response_ss, status_line_from_fs); // Read the first line (e.g., "200 OK")
-        // Read the rest as body
-        // If there's a second line, it's the body. If not, body is empty.
-        // The behavior of getline on an empty stream (after first line read) is fine.
-        getline(fs_response_ss, body_from_fs, '\0'); // Read till null terminator if present, or end of stream.
+        // While the client has more pipelined requests buffered, keep
+        // processing them back-to-back; socket channels use MSG_MORE so the
+        // kernel sends their responses together once the queue is empty.
+        bool more_queued = has_buffered_command(session.reader);
 
-        // Remove any trailing newlines/carriage returns from status_line_from_fs
-        if (!status_line_from_fs.empty() && status_line_from_fs.back() == '\r') {
-             status_line_from_fs.pop_back();
+        // Send the full response back to the client
+        ssize_t sent;
+        {
+            TraceScope span("send response");
+            lock_guard<mutex> send_guard(session.send_lock);
+            flush_outbox(session, true);
+            sent = send_response(*channel, header, *session.fs, more_queued, zero_copy_bytes);
         }
-        if (!status_line_from_fs.empty() && status_line_from_fs.back() == '\n') {
-             status_line_from_fs.pop_back();
+        try_flush_outbox(session); // invalidations queued while it was sent
+        if (slow_trace_ns >= 0) {
+            set_current_trace(NULL);
+            session.trace.end();
+        }
+        if (sent == -1) {
+            logger.log(LOG_ERROR, "Error sending response to client " + to_string(id) + ": " +
+                                  strerror(errno));
+            break; // Break loop on send error
+        }
+        bytes_sent += sent;
+
+        // One line per request; too many to log each one unless debugging
+        bool sampled = logger.enabled(LOG_INFO) && logger.sample();
+        if (sampled || logger.enabled(LOG_DEBUG)) {
+            string line = "Client " + to_string(id) + ": [" + client_request_line + "] " +
+                          fs_raw_response + ", " + to_string(sent) + " bytes";
+            logger.log(sampled ? LOG_INFO : LOG_DEBUG, line);
         }
 
-        // Build the final response string
-        stringstream full_response_ss;
-        full_response_ss << status_line_from_fs << "\r\n"; // First header line
-        full_response_ss << "Length:" << body_from_fs.length() << "\r\n"; // Second header line
-        full_response_ss << "\r\n"; // Blank line
-        full_response_ss << body_from_fs; // Message body
+        // Keep the trace of a slow request
+        if (slow_trace_ns >= 0 && session.trace.duration_ns() >= slow_trace_ns) {
+            slow_traces.write(session.trace, id);
+        }
+    }
+    set_current_trace(NULL); // the loop may have ended mid-request
+
+    // Client disconnected or error occurred, close the channel and end the
+    // session
+    logger.log(LOG_INFO, "Client " + to_string(id) + ": sent " + to_string(bytes_sent) +
+                         " response bytes. Closing the connection.");
+    detach_session(session);
+    channel->close(); // Close communication channel
+    delete channel;
+}
 
-        string full_response = full_response_ss.str();
+int main(int argc, char* argv[]) {
+    // Options: -l log level, -s log one in every n requests, -t trace
+    // requests taking at least this many ms, -d emulate a device, -v export
+    // a volume (repeatable)
+    LogLevel level = LOG_INFO;
+    DiskModel disk_model;
+    string option_error;
+    int sample_every = DEFAULT_SAMPLE_EVERY;
+    double slow_ms = -1;
+    int arg = 1;
+    bool options_ok = true;
+    for (; options_ok && arg + 1 < argc && argv[arg][0] == '-'; arg += 2) {
+        string flag = argv[arg];
+        if (flag == "-l") {
+            options_ok = Logger::parse_level(argv[arg + 1], level);
+        } else if (flag == "-s") {
+            sample_every = atoi(argv[arg + 1]);
+            options_ok = sample_every > 0;
+        } else if (flag == "-t") {
+            char *end;
+            slow_ms = strtod(argv[arg + 1], &end);
+            options_ok = *end == '\0' && slow_ms >= 0;
+        } else if (flag == "-d") {
+            options_ok = DiskModel::parse(argv[arg + 1], disk_model, option_error);
+        } else if (flag == "-v") {
+            // name=disk_path; names are unique and one word, the path may
+            // be a striped or mirrored layout
+            string spec = argv[arg + 1];
+            size_t equals = spec.find('=');
+            string name = spec.substr(0, equals);
+            string disk_path = equals == string::npos ? "" : spec.substr(equals + 1);
+            vector<vector<string> > mirrors;
+            int stripe_blocks;
+            if (name.empty() || name.find_first_of(" \t\r\n") != string::npos) {
+                option_error = "invalid volume name \"" + name + "\"";
+            }
+            for (size_t i = 0; option_error.empty() && i < exports.size(); i++) {
+                if (exports[i]->name == name) {
+                    option_error = "duplicate volume name " + name;
+                }
+            }
+            options_ok = option_error.empty() &&
+                         Disk::parse_layout(disk_path, mirrors, stripe_blocks, option_error);
+            if (options_ok) {
+                Export *exp = new Export;
+                exp->name = name;
+                exp->disk_path = disk_path;
+                exports.push_back(exp);
+            }
+        } else {
+            options_ok = false;
+        }
+    }
+    int stats_interval = (arg + 1 < argc) ? atoi(argv[arg + 1]) : 0;
+    if (!options_ok || arg >= argc || arg + 2 < argc || (arg + 1 < argc && stats_interval <= 0)) {
+        if (!option_error.empty()) {
+            cerr << "Error: " << option_error << "\n";
+        }
+        cout << "Usage: ./nfsserver [-l error|warn|info|debug|trace] [-s sample_every] [-t slow_ms]\n"
+             << "                   [-d none|ssd|hdd[,key=value...]] [-v name=disk_path]...\n"
+             << "                   port# | unix:/socket/path | shm:name [stats_interval_s]\n"
+             << "(a disk_path may stripe the volume over several files and mirror it:\n"
+             << " files[+files...][:stripe_blocks], files being file[,file...])\n";
+        return -1;
+    }
+    string location = argv[arg];
+    if (exports.empty()) {
+        Export *exp = new Export;
+        exp->name = DEFAULT_VOLUME;
+        exp->disk_path = DEFAULT_DISK;
+        exports.push_back(exp);
+    }
 
-        // For debugging server-side
-        cout << "Sending response (Total Bytes: " << full_response.length() << "):\n";
-        cout << full_response << "END_RESPONSE_DELIMITER\n"; // Delimiter for visual clarity only
+    // Listen for clients at the location: a TCP port, a unix-domain socket
+    // or a shared-memory segment for clients on the same host
+    ChannelListener *listener;
+    if (location.compare(0, 5, "unix:") == 0) {
+        listener = SocketListener::listen_unix(location.substr(5));
+    } else if (location.compare(0, 4, "shm:") == 0) {
+        listener = ShmListener::create(location.substr(4));
+    } else {
+        listener = SocketListener::listen_tcp(atoi(location.c_str()));
+    }
+    if (listener == NULL) {
+        return -1;
+    }
 
-        // Send the full response back to the client
-        if (send_all(comm_sock, full_response.c_str(), full_response.length()) == -1) {
-            cerr << "Error sending response: " << strerror(errno) << endl;
-            break; // Break loop on send error
+    logger.set_level(level);
+    logger.set_sample_every(sample_every);
+    logger.start(cout);
+
+    // Trace every request, keeping those that took slow_ms or longer
+    if (slow_ms >= 0) {
+        if (!slow_traces.open(SLOW_TRACE_FILE)) {
+            logger.log(LOG_ERROR, string("Cannot write ") + SLOW_TRACE_FILE);
+            logger.stop();
+            return -1;
         }
+        slow_trace_ns = (long long) (slow_ms * 1000000);
+        char message[128];
+        snprintf(message, sizeof(message), "Tracing requests of %g ms or more to %s", slow_ms,
+                 SLOW_TRACE_FILE);
+        logger.log(LOG_INFO, message);
     }
 
-    // Client disconnected or error occurred, close sockets and unmount
-    cout << "Server shutting down. Closing sockets and unmounting file system." << endl;
-    close(comm_sock); // Close communication socket
-    close(listen_sock); // Close listening socket
-    fs.unmount(); // This will also close fs_sock
+    // Each volume has its own disk, block cache and allocator
+    for (size_t i = 0; i < exports.size(); i++) {
+        exports[i]->volume.bfs.mount(exports[i]->disk_path.c_str());
+        exports[i]->volume.bfs.set_disk_model(disk_model);
+        logger.log(LOG_INFO, "Exporting volume " + exports[i]->name + " from " + exports[i]->disk_path +
+                             (i == 0 ? " (default)" : ""));
+    }
+    logger.log(LOG_INFO, "File system mounted. NFS Server listening on " + location + "...");
+    if (disk_model.kind() != DiskModel::NONE) {
+        logger.log(LOG_INFO, "Emulating disk: " + disk_model.describe());
+    }
+
+    // With an interval, log the metrics (also available to clients with a
+    // "stats" request) periodically
+    if (stats_interval > 0) {
+        thread(dump_stats, stats_interval).detach();
+    }
+
+    // Serve every client in its own thread
+    int next_id = 1;
+    while (true) {
+        Channel *channel = listener->accept(); // Channel for communication with the client
+        if (channel == NULL) {
+            break;
+        }
+        thread(serve_client, channel, next_id++).detach();
+    }
+
+    logger.log(LOG_INFO, "Server shutting down. Closing sockets and unmounting file system.");
+    delete listener; // Close listening socket or shared memory
+    for (size_t i = 0; i < exports.size(); i++) {
+        exports[i]->volume.bfs.unmount();
+        delete exports[i];
+    }
+    logger.stop();
 
     return 0;
-}
\ No newline at end of file
+}